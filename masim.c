@@ -1,31 +1,34 @@
 #include <argp.h>
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <locale.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/shm.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <linux/mempolicy.h>
+
 #include "misc.h"
 #include "masim.h"
 
-#define HUGETLB_PROTECTION (PROT_READ | PROT_WRITE)
-
-#ifdef __ia64__
-#define HUGETLB_ADDR (void *)(0x8000000000000000UL)
-#define HUGETLB_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_FIXED)
-#else
-#define HUGETLB_ADDR (void *)(0x0UL)
-#define HUGETLB_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB)
-#endif
 int use_hugetlb = 0;
 
 #define LEN_ARRAY(x) (sizeof(x) / sizeof(*x))
+#define LONG_BITS	(sizeof(long) * 8)
+
+#define SZ_CACHELINE	64
+#define SZ_PAGE	4096
+#define SZ_2M	(1UL << 21)
+#define SZ_1G	(1UL << 30)
 
 enum hintmethod {
 	NONE,
@@ -44,27 +47,63 @@ enum rw_mode default_rw_mode = WRITE_ONLY;
 
 /* can be overriden with --repeat */
 int nr_repeats = 1;
+/* keep the regions mapped across the repeats */
+static int keep_regions;
 
 /* can be overriden with --log_interval */
 int log_interval_ms = 0;
 
 /*
- * To minimize random number calculation overhead, we make rand_batch of
- * rand_arr_sz random number arrays at initialization (init_randints()) and
- * assign the array of the arrays at rndints.  Read rndint(), the function for
- * getting a single random number in runtime, to knwo how the pre-initialized
- * random numbers are really being used.
+ * Time one of this number of accesses and record the latency in the
+ * histogram of the pattern.  Zero disables the sampling.
+ *
+ * can be overriden with --sample_latency
+ */
+static int lat_sample_interval;
+
+/*
+ * Record one of this number of accesses to record_file, in the access trace
+ * file format.  record_start is the time of the start of the recording.
+ *
+ * can be set with --record and --record_interval
+ */
+static char *record_path;
+static int record_interval = 1024;
+static FILE *record_file;
+static unsigned long long record_start;
+static struct mregion *record_regions;
+
+enum stats_format {
+	STATS_JSON,
+	STATS_CSV,
+};
+
+/*
+ * File for the machine-readable statistics of the patterns, which are written
+ * for each phase and each log interval.  NULL if not requested.
+ *
+ * can be set with --stats_fd and --stats_format
+ */
+static FILE *stats_file;
+static enum stats_format stats_format = STATS_JSON;
+
+/*
+ * Hardware performance counters that read for each phase and each log
+ * interval.
  *
- * Which byte in each region to access under random access mode is determined
- * by rndint().  If the size of region is very huge compared to total prepared
- * random numbers in rndints, the program may not access entire bytes of the
- * region.  User should increase the prepared random numbers in the case.  Or,
- * this program should handle such case when selecting whych byte to access.
+ * can be enabled with --perf
+ */
+static int perf_enabled;
+static struct aperf perf;
+
+/*
+ * Seed for the random numbers.  Each thread has its own random number
+ * generator that seeded with this, the sequence of the phase, and the index
+ * of the thread.
  *
- * can be overriden with --random_batch and --random_array
+ * can be overriden with --seed
  */
-static int rand_batch = 1000;
-static int rand_arr_sz = 1000;
+static unsigned long long rnd_seed = 42;
 
 /*
  * To make the overall performance is ruled by not probabilistic region
@@ -72,14 +111,74 @@ static int rand_arr_sz = 1000;
  * per region, for each of the probabilistic region selection.  Maybe a better
  * name was nr_accesses_per_region_selection.
  *
- * If rand_arr_sz is not big, and the purpose of the program run is not
- * accurate measurements of the hardware's access speed, this may better to be
- * low.
+ * If the purpose of the program run is not accurate measurements of the
+ * hardware's access speed, but fine-grained mixing of the patterns, this may
+ * better to be low.
  *
  * can be overriden with  --nr_accesses_per_region
  */
 static int nr_accesses_per_region =  1024 * 128;
 
+/* number of threads for prefaulting and loading the initial data of regions */
+static int nr_init_threads = 1;
+
+static const char * const numa_mode_str[] = {
+	[MPOL_DEFAULT] = "default",
+	[MPOL_PREFERRED] = "preferred",
+	[MPOL_BIND] = "bind",
+	[MPOL_INTERLEAVE] = "interleave",
+};
+
+static void pr_numa_policy(struct mregion *region)
+{
+	int i;
+
+	printf(", numa %s", numa_mode_str[region->numa_mode]);
+	for (i = 0; i < MAX_NUMA_NODES; i++) {
+		if (region->nodemask[i / LONG_BITS] & (1UL << (i % LONG_BITS)))
+			printf(" %d", i);
+	}
+}
+
+static const char * const page_policy_str[] = {
+	[PAGES_DEFAULT] = "default",
+	[PAGES_4K] = "4k",
+	[PAGES_THP] = "thp",
+	[PAGES_NOTHP] = "nothp",
+	[PAGES_HUGETLB] = "hugetlb",
+	[PAGES_2M] = "2m",
+	[PAGES_1G] = "1g",
+};
+
+static const char * const region_backing_str[] = {
+	[BACKING_ANON] = "anon",
+	[BACKING_FILE] = "file",
+	[BACKING_FILE_PRIVATE] = "file_private",
+	[BACKING_MEMFD] = "memfd",
+	[BACKING_SHM] = "shm",
+	[BACKING_SYSV] = "sysv",
+};
+
+static const char * const region_populate_str[] = {
+	[POPULATE_NONE] = "none",
+	[POPULATE_PREFAULT] = "prefault",
+	[POPULATE_DROP] = "drop",
+	[POPULATE_MAP] = "map",
+};
+
+static const char * const region_load_str[] = {
+	[LOAD_READ] = "read",
+	[LOAD_COPY] = "copy",
+	[LOAD_MAP] = "map",
+};
+
+static void pr_backing(struct mregion *region)
+{
+	printf(", backing %s", region_backing_str[region->backing]);
+	if (region->backing_file)
+		printf(" %s", region->backing_file);
+}
+
 void pr_regions(struct mregion *regions, size_t nr_regions)
 {
 	struct mregion *region;
@@ -88,26 +187,123 @@ void pr_regions(struct mregion *regions, size_t nr_regions)
 	printf("memory regions\n");
 	for (i = 0; i < nr_regions; i++) {
 		region = &regions[i];
-		printf("\t%s: %zu bytes\n", region->name, region->sz);
+		printf("\t%s: %zu bytes", region->name, region->sz);
+		if (region->pages != PAGES_DEFAULT)
+			printf(", pages %s", page_policy_str[region->pages]);
+		if (region->backing != BACKING_ANON)
+			pr_backing(region);
+		if (region->populate != POPULATE_NONE)
+			printf(", populate %s",
+					region_populate_str[region->populate]);
+		if (region->data_file)
+			printf(", load %s %s", region_load_str[region->load],
+					region->data_file);
+		if (region->numa_mode != MPOL_DEFAULT)
+			pr_numa_policy(region);
+		printf("\n");
 	}
 	printf("\n");
 }
 
+static const char * const access_order_str[] = {
+	[SEQUENTIAL] = "sequentially",
+	[RANDOM] = "randomly",
+	[CHASE] = "pointer-chasing",
+	[SHUFFLE] = "shuffled",
+	[REPLAY] = "replaying",
+};
+
+static void pr_threads(char *prefix, int nr_threads, int *cpus, int nr_cpus)
+{
+	printf("%s%d threads", prefix, nr_threads);
+	if (nr_cpus) {
+		astr_pr_int_list(" on cpus", cpus, nr_cpus);
+	} else {
+		printf("\n");
+	}
+}
+
+static const char *width_kernels_isa(size_t width);
+
+static void pr_dist(struct access *pattern)
+{
+	double *args = pattern->dist_args;
+
+	switch (pattern->dist) {
+	case ZIPF:
+		printf("\t\tzipfian distribution with theta %.3f\n", args[0]);
+		break;
+	case HOTSET:
+		printf("\t\t%.2f%% accesses to first %.2f%% bytes\n",
+				args[0], args[1]);
+		break;
+	case GAUSSIAN:
+		printf("\t\tgaussian distribution with stddev %.2f%% bytes, "
+				"center moving %.2f%% bytes/sec\n",
+				args[0], args[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+static void pr_replay(struct access *pattern)
+{
+	printf("\t\t%s %zu accesses of %s, reported as region %s\n",
+			access_order_str[REPLAY], pattern->trace->nr_records,
+			pattern->trace_file, pattern->mregion->name);
+	if (pattern->trace_speed)
+		printf("\t\tat %gx speed of the timestamps\n",
+				pattern->trace_speed);
+	else
+		printf("\t\tas fast as possible\n");
+}
+
 void pr_phase(struct phase *phase)
 {
 	struct access *pattern;
 	int j;
 
-	printf("Phase (%s) for %u ms\n", phase->name, phase->time_ms);
+	if (phase->work) {
+		printf("Phase (%s) for %llu %s", phase->name, phase->work,
+				phase->work_in_bytes ? "bytes" : "accesses");
+		if (phase->time_ms)
+			printf(" or %u ms", phase->time_ms);
+		printf("\n");
+	} else {
+		printf("Phase (%s) for %u ms\n", phase->name,
+				phase->time_ms);
+	}
+	if (phase->nr_threads != 1 || phase->nr_cpus)
+		pr_threads("\t", phase->nr_threads, phase->cpus,
+				phase->nr_cpus);
 	for (j = 0; j < phase->nr_patterns; j++) {
 		pattern = &phase->patterns[j];
 		printf("\tPattern %d\n", j);
-		printf("\t\t%s access region %s with stride %zu\n",
-				pattern->random_access ?
-				"randomly" : "sequentially",
-				pattern->mregion == NULL ?
-				"..." : pattern->mregion->name,
-				pattern->stride);
+		if (pattern->order == REPLAY)
+			pr_replay(pattern);
+		else
+			printf("\t\t%s access region %s with stride %zu\n",
+					access_order_str[pattern->order],
+					pattern->mregion == NULL ?
+					"..." : pattern->mregion->name,
+					pattern->stride);
+		if (pattern->width > 1)
+			printf("\t\t%zu bytes access width (%s)\n",
+					pattern->width,
+					width_kernels_isa(pattern->width));
+		if (pattern->unit_offset)
+			printf("\t\toffset %zu of each stride\n",
+					pattern->unit_offset);
+		if (pattern->dist != UNIFORM)
+			pr_dist(pattern);
+		if (pattern->chains_sweep)
+			printf("\t\tsweeping 1-%d chains\n", MAX_CHASE_CHAINS);
+		else if (pattern->nr_chains > 1)
+			printf("\t\t%d chains\n", pattern->nr_chains);
+		if (pattern->nr_threads)
+			pr_threads("\t\tdedicated ", pattern->nr_threads,
+					pattern->cpus, pattern->nr_cpus);
 	}
 
 }
@@ -125,169 +321,713 @@ struct access_config {
 	ssize_t nr_regions;
 	struct phase *phases;
 	ssize_t nr_phases;
+	/* if the regions are mapped and initialized */
+	int regions_ready;
+	/* strings and patterns of the config */
+	struct aarena arena;
+	/* the mapped compiled config file, if the config is loaded from it */
+	char *msb;
+	size_t msb_sz;
 };
 
-size_t **rndints;
+/* per-thread random number generator */
+static __thread struct arnd rnd;
 
-inline static size_t rand64() {
-	return ((size_t)rand() << 32) | rand();
+/*
+ * Returns a random integer in [0, @range)
+ */
+static inline size_t rndint(size_t range)
+{
+	return arnd_range(&rnd, range);
 }
 
-static void init_rndints(void)
+/*
+ * Offset of the link in each unit of a pointer chasing chain.  The link is
+ * placed at the end of the unit, so that accesses to the start of the units
+ * don't break the chain.
+ */
+static inline size_t chase_link_offset(size_t stride)
 {
-	int i, j;
+	return stride - sizeof(size_t);
+}
 
-	rndints = malloc(sizeof(rndints) * rand_batch);
-	for (i = 0; i < rand_batch; i++) {
-		rndints[i] = malloc(sizeof(rndints[0]) * rand_arr_sz);
-		for (j = 0; j < rand_arr_sz; j++)
-			rndints[i][j] = rand64();
-	}
-	rndints[0][0] = 1;
+/*
+ * Non-temporal operations for each element type of the access operations.
+ *
+ * Non-temporal stores bypass the caches, and non-temporal loads use the
+ * streaming load instructions, or the non-temporal prefetch if the
+ * instructions are not available for the type.  Stores to single byte are
+ * made for the aligned eight bytes containing it.  On architectures other
+ * than x86_64, these are same to the normal operations.
+ */
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SIMD_KERNELS
+
+#define ATTR_SSE41	__attribute__((target("sse4.1")))
+#define ATTR_AVX2	__attribute__((target("avx2")))
+#define ATTR_AVX512	__attribute__((target("avx512f")))
+
+/* the cpu doesn't support clflushopt, so use clflush instead */
+static int no_clflushopt;
+
+static inline void flush_line(char *p)
+{
+	if (no_clflushopt)
+		__asm__ __volatile__("clflush %0" : "+m"(*(volatile char *)p));
+	else
+		__asm__ __volatile__("clflushopt %0"
+				: "+m"(*(volatile char *)p));
 }
 
-static void fini_rndints(void)
+static inline void u64_ntst(uint64_t *p)
 {
-	int i;
+	_mm_stream_si64((long long *)p, 1);
+}
+
+static inline void u8_ntst(char *p)
+{
+	u64_ntst((uint64_t *)((uintptr_t)p & ~(sizeof(uint64_t) - 1)));
+}
+
+static inline ATTR_SSE41 void m128_ntst(__m128i *p)
+{
+	_mm_stream_si128(p, _mm_set1_epi64x(1));
+}
+
+static inline ATTR_SSE41 void m128_ntld(__m128i *p)
+{
+	__m128i val = _mm_stream_load_si128(p);
+
+	__asm__ __volatile__("" : : "x"(val));
+}
+
+static inline ATTR_AVX2 void m256_ntst(__m256i *p)
+{
+	_mm256_stream_si256(p, _mm256_set1_epi64x(1));
+}
+
+static inline ATTR_AVX2 void m256_ntld(__m256i *p)
+{
+	__m256i val = _mm256_stream_load_si256(p);
+
+	__asm__ __volatile__("" : : "x"(val));
+}
+
+static inline ATTR_AVX512 void m512_ntst(__m512i *p)
+{
+	_mm512_stream_si512(p, _mm512_set1_epi64(1));
+}
+
+static inline ATTR_AVX512 void m512_ntld(__m512i *p)
+{
+	__m512i val = _mm512_stream_load_si512(p);
+
+	__asm__ __volatile__("" : : "v"(val));
+}
+
+#else	/* __x86_64__ */
+
+static inline void flush_line(char *p)
+{
+}
 
-	for (i = 0; i < rand_batch; i++)
-		free(rndints[i]);
-	free(rndints);
+static inline void u64_ntst(uint64_t *p)
+{
+	ACCESS_ONCE(*p) = 1;
+}
+
+static inline void u8_ntst(char *p)
+{
+	ACCESS_ONCE(*p) = 1;
+}
+#endif	/* __x86_64__ */
+
+static inline void u64_ntld(uint64_t *p)
+{
+	__builtin_prefetch(p, 0, 0);
+	(void)ACCESS_ONCE(*p);
+}
+
+static inline void u8_ntld(char *p)
+{
+	__builtin_prefetch(p, 0, 0);
+	(void)ACCESS_ONCE(*p);
 }
 
 /*
- * Returns a random integer
+ * Access operations of each access width.
+ *
+ * DEFINE_WIDTH_OPS() defines load, store, read-modify-write, non-temporal
+ * store, store and flush, and non-temporal load operations for an access
+ * width, that made with @nr accesses of @type.  @elem is the prefix of the
+ * non-temporal operations for @type.  @attr is the function attribute for the
+ * instructions that the type needs.
  */
-static size_t rndint(void)
-{
-	static int rndofs;
-	static int rndarr;
+#define DEFINE_WIDTH_OPS(name, type, nr, elem, attr)			\
+static inline attr void name##_ld(char *p)				\
+{									\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++)					\
+		(void)((volatile type *)p)[i];				\
+}									\
+									\
+static inline attr void name##_st(char *p)				\
+{									\
+	type val = {1};							\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++)					\
+		((volatile type *)p)[i] = val;				\
+}									\
+									\
+static inline attr void name##_rmw(char *p)				\
+{									\
+	type one = {1};							\
+	type val;							\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++) {					\
+		val = ((volatile type *)p)[i];				\
+		((volatile type *)p)[i] = val + one;			\
+	}								\
+}									\
+									\
+static inline attr void name##_ntst(char *p)				\
+{									\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++)					\
+		elem##_ntst(&((type *)p)[i]);				\
+}									\
+									\
+static inline attr void name##_flst(char *p)				\
+{									\
+	name##_st(p);							\
+	flush_line(p);							\
+}									\
+									\
+static inline attr void name##_ntld(char *p)				\
+{									\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++)					\
+		elem##_ntld(&((type *)p)[i]);				\
+}
+
+/*
+ * DEFINE_WIDTH_KERNELS() defines the access kernels using the operations of
+ * @ops, and the struct width_kernels for those.  A kernel is defined for each
+ * combination of the access order, the rw mode, and the stride class, so
+ * that the hot loops have no branch for those.  The kernel for a pattern is
+ * selected by access_fn_of() at parse time.
+ *
+ * The kernels return the number of the accesses they made.  Those copy the
+ * fields of @access that used in the loops to local variables, because the
+ * stores to the region could alias those.
+ */
+
+/* non-temporal stores should be made globally visible at the end */
+#define RW_FENCE_ld()
+#define RW_FENCE_st()
+#define RW_FENCE_rmw()
+#define RW_FENCE_ntst()		smp_wmb()
+#define RW_FENCE_flst()
+#define RW_FENCE_ntld()
+
+/*
+ * Stride classes.  UNIT_OFFSET_<class>() returns the offset of @unit-th
+ * stride-sized unit, using the variables that STRIDE_VARS_<class>() defines.
+ * Power of two strides use a shift instead of the multiplication.
+ */
+enum stride_class {
+	STRIDE_ANY,
+	STRIDE_POW2,
+	NR_STRIDE_CLASSES,
+};
+
+#define STRIDE_VARS_any(access)		size_t stride = (access)->stride
+#define UNIT_OFFSET_any(unit)		((unit) * stride)
+#define STRIDE_VARS_pow2(access)					\
+	int stride_shift = __builtin_ctzl((access)->stride)
+#define UNIT_OFFSET_pow2(unit)		((unit) << stride_shift)
+
+/* Sequential accesses wrap around before touching the end of the region */
+#define DEFINE_SEQ_KERNEL(ops, rw, width, attr)				\
+static attr int do_seq_##rw##_##ops(struct access *access)		\
+{									\
+	struct mregion *region = access->mregion;			\
+	char *rr = region->region;					\
+	size_t last = region->sz - width;				\
+	size_t stride = access->stride;					\
+	size_t offset = access->last_offset;				\
+	int nr = access->nr_chunk_accesses;				\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++) {					\
+		offset += stride;					\
+		if (offset > last)					\
+			offset = 0;					\
+		ops##_##rw(&rr[offset]);				\
+	}								\
+	access->last_offset = offset;					\
+	RW_FENCE_##rw();						\
+	return nr;							\
+}
+
+/*
+ * Shuffle kernels access the units in the order of the permutation of the
+ * epoch, starting from @access->shuffle_first-th one and skipping the units
+ * for other threads.  New epoch with a new permutation starts after the end
+ * of the permutation.
+ */
+#define DEFINE_SHUFFLE_KERNEL(ops, sclass, rw, width, attr)		\
+static attr int do_shuffle_##sclass##_##rw##_##ops(struct access *access) \
+{									\
+	char *rr = access->mregion->region + access->unit_offset;	\
+	struct avgn_perm perm = access->perm;				\
+	size_t first = access->shuffle_first;				\
+	size_t step = access->shuffle_step;				\
+	size_t pos = access->shuffle_pos;				\
+	int nr = access->nr_chunk_accesses;				\
+	STRIDE_VARS_##sclass(access);					\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++) {					\
+		if (pos >= perm.n) {					\
+			next_shuffle_epoch(access);			\
+			perm = access->perm;				\
+			pos = first;					\
+		}							\
+		ops##_##rw(&rr[UNIT_OFFSET_##sclass(			\
+					avgn_perm_val(&perm, pos))]);	\
+		pos += step;						\
+	}								\
+	access->shuffle_pos = pos;					\
+	RW_FENCE_##rw();						\
+	return nr;							\
+}
+
+/*
+ * The random access kernels are defined for each distribution, using
+ * <dist>_unit() that returns a random unit index in [0, @nr_units).  The
+ * units are stride-sized, and each access is made to the offset of the unit.
+ * The random number generator is also copied, to avoid saving its state to
+ * the thread local storage for every access.
+ */
+#define DEFINE_RND_KERNEL(ops, dist, sclass, rw, width, attr)		\
+static attr int do_##dist##_##sclass##_##rw##_##ops(struct access *access) \
+{									\
+	struct mregion *region = access->mregion;			\
+	char *rr = region->region + access->unit_offset;		\
+	size_t nr_units = region->sz / access->stride;			\
+	struct arnd r = rnd;						\
+	int nr = access->nr_chunk_accesses;				\
+	STRIDE_VARS_##sclass(access);					\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++)					\
+		ops##_##rw(&rr[UNIT_OFFSET_##sclass(			\
+				dist##_unit(access, nr_units, &r))]);	\
+	rnd = r;							\
+	RW_FENCE_##rw();						\
+	return nr;							\
+}
+
+/*
+ * Replay kernels make the accesses of the records of the trace, starting from
+ * @access->trace_pos-th one and skipping the records for other threads.
+ * Records after @access->trace_until in the trace time are left for the next
+ * call, so the kernels can make no access.  The records are replayed again
+ * after the end of the trace, in the next pass that starts a period later.
+ * Offsets are aligned to the width after wrapped around into the regions.
+ */
+#define DEFINE_REPLAY_KERNEL(ops, width, attr)				\
+static attr int do_replay_##ops(struct access *access)			\
+{									\
+	struct mtrace *trace = access->trace;				\
+	struct mtr_record *records = trace->records;			\
+	size_t nr_records = trace->nr_records;				\
+	size_t pos = access->trace_pos;					\
+	size_t step = access->trace_step;				\
+	uint64_t base = access->trace_base;				\
+	uint64_t until = access->trace_until;				\
+	struct mtr_record *rec;						\
+	struct mregion *region;						\
+	size_t offset;							\
+	int nr = access->nr_chunk_accesses;				\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++) {					\
+		if (pos >= nr_records) {				\
+			pos %= nr_records;				\
+			base += trace->period_ns;			\
+			access->trace_prefetched = 0;			\
+		}							\
+		if (pos >= access->trace_prefetched)			\
+			prefetch_trace(access, pos);			\
+		rec = &records[pos];					\
+		if (base + rec->ts_ns > until)				\
+			break;						\
+		region = &trace->regions[rec->region % trace->nr_regions]; \
+		offset = rec->offset;					\
+		if (offset > region->sz - width)			\
+			offset %= region->sz - width + 1;		\
+		offset &= ~(size_t)(width - 1);				\
+		if (rec->write)						\
+			ops##_st(&region->region[offset]);		\
+		else							\
+			ops##_ld(&region->region[offset]);		\
+		pos += step;						\
+	}								\
+	access->trace_pos = pos;					\
+	access->trace_base = base;					\
+	return i;							\
+}
+
+#define DEFINE_RW_KERNELS(DEFINE_KERNEL, ...)				\
+DEFINE_KERNEL(__VA_ARGS__, ld)						\
+DEFINE_KERNEL(__VA_ARGS__, st)						\
+DEFINE_KERNEL(__VA_ARGS__, rmw)						\
+DEFINE_KERNEL(__VA_ARGS__, ntst)					\
+DEFINE_KERNEL(__VA_ARGS__, flst)					\
+DEFINE_KERNEL(__VA_ARGS__, ntld)
+
+#define DEFINE_STRIDE_KERNELS(DEFINE_KERNEL, ...)			\
+DEFINE_RW_KERNELS(DEFINE_KERNEL, __VA_ARGS__, any)			\
+DEFINE_RW_KERNELS(DEFINE_KERNEL, __VA_ARGS__, pow2)
+
+#define DEFINE_SEQ_RW_KERNEL(ops, width, attr, rw)			\
+	DEFINE_SEQ_KERNEL(ops, rw, width, attr)
+#define DEFINE_SHUFFLE_RW_KERNEL(ops, width, attr, sclass, rw)		\
+	DEFINE_SHUFFLE_KERNEL(ops, sclass, rw, width, attr)
+#define DEFINE_RND_RW_KERNEL(ops, dist, width, attr, sclass, rw)	\
+	DEFINE_RND_KERNEL(ops, dist, sclass, rw, width, attr)
 
-	if (rndofs == rand_arr_sz) {
-		rndarr = rand() % rand_batch;
-		rndofs = 0;
+#define RW_KERNELS(prefix, ops)						\
+	{								\
+		[READ_ONLY] = do_##prefix##_ld_##ops,			\
+		[WRITE_ONLY] = do_##prefix##_st_##ops,			\
+		[READ_WRITE] = do_##prefix##_rmw_##ops,			\
+		[NT_WRITE_ONLY] = do_##prefix##_ntst_##ops,		\
+		[FLUSH_WRITE_ONLY] = do_##prefix##_flst_##ops,		\
+		[NT_READ_ONLY] = do_##prefix##_ntld_##ops,		\
 	}
 
-	return rndints[rndarr][rndofs++];
+#define STRIDE_KERNELS(prefix, ops)					\
+	{								\
+		[STRIDE_ANY] = RW_KERNELS(prefix##_any, ops),		\
+		[STRIDE_POW2] = RW_KERNELS(prefix##_pow2, ops),		\
+	}
+
+#define DEFINE_WIDTH_KERNELS(ops, width, attr)				\
+DEFINE_RW_KERNELS(DEFINE_SEQ_RW_KERNEL, ops, width, attr)		\
+DEFINE_STRIDE_KERNELS(DEFINE_SHUFFLE_RW_KERNEL, ops, width, attr)	\
+DEFINE_STRIDE_KERNELS(DEFINE_RND_RW_KERNEL, ops, uniform, width, attr)	\
+DEFINE_STRIDE_KERNELS(DEFINE_RND_RW_KERNEL, ops, zipf, width, attr)	\
+DEFINE_STRIDE_KERNELS(DEFINE_RND_RW_KERNEL, ops, hotset, width, attr)	\
+DEFINE_STRIDE_KERNELS(DEFINE_RND_RW_KERNEL, ops, gauss, width, attr)	\
+DEFINE_REPLAY_KERNEL(ops, width, attr)					\
+									\
+static const struct width_kernels ops##_kernels = {			\
+	.isa = #ops,							\
+	.seq = RW_KERNELS(seq, ops),					\
+	.shuffle = STRIDE_KERNELS(shuffle, ops),			\
+	.rnd = {							\
+		[UNIFORM] = STRIDE_KERNELS(uniform, ops),		\
+		[ZIPF] = STRIDE_KERNELS(zipf, ops),			\
+		[HOTSET] = STRIDE_KERNELS(hotset, ops),			\
+		[GAUSSIAN] = STRIDE_KERNELS(gauss, ops),		\
+	},								\
+	.replay = do_replay_##ops,					\
+};
+
+struct width_kernels {
+	const char *isa;
+	access_fn seq[NR_RW_MODES];
+	access_fn shuffle[NR_STRIDE_CLASSES][NR_RW_MODES];
+	access_fn rnd[NR_ACCESS_DISTS][NR_STRIDE_CLASSES][NR_RW_MODES];
+	access_fn replay;
+};
+
+/* Each epoch has its own permutation that same for all threads */
+static void next_shuffle_epoch(struct access *access)
+{
+	access->shuffle_epoch++;
+	avgn_perm_init(&access->perm, access->perm.n,
+			access->perm_seed + access->shuffle_epoch);
 }
 
-static void do_rnd_ro(struct access *access)
+/* Records of the trace are prefetched in windows of this size */
+#define SZ_TRACE_PREFETCH	(16UL << 20)
+
+/* Ask the kernel to read the window of @trace from @pos-th record */
+static void advise_trace_window(struct mtrace *trace, size_t pos)
 {
-	struct mregion *region = access->mregion;
-	char *rr = region->region;
-	int i;
-	char __attribute__((unused)) read_val;
+	size_t nr = SZ_TRACE_PREFETCH / sizeof(*trace->records);
+	uintptr_t start, end;
 
-	for (i = 0; i < nr_accesses_per_region; i++)
-		read_val = ACCESS_ONCE(rr[rndint() % region->sz]);
+	start = (uintptr_t)&trace->records[pos] & ~(SZ_PAGE - 1);
+	end = (uintptr_t)&trace->records[pos + nr < trace->nr_records ?
+		pos + nr : trace->nr_records];
+	madvise((void *)start, end - start, MADV_WILLNEED);
 }
 
-static void do_seq_ro(struct access *access)
+/*
+ * Ask the kernel to read the window of the trace next to the window of
+ * @pos-th record, or the first window if it is the last one, so that the
+ * reads of the trace file are made while the current window is replayed.
+ */
+static void prefetch_trace(struct access *access, size_t pos)
 {
-	struct mregion *region = access->mregion;
-	char *rr = region->region;
-	size_t offset = access->last_offset;
-	int i;
-	char __attribute__((unused)) read_val;
+	struct mtrace *trace = access->trace;
+	size_t nr = SZ_TRACE_PREFETCH / sizeof(*trace->records);
 
-	for (i = 0; i < nr_accesses_per_region; i++) {
-		offset += access->stride;
-		if (offset >= region->sz)
-			offset = 0;
-		read_val = ACCESS_ONCE(rr[offset]);
-	}
-	access->last_offset = offset;
+	advise_trace_window(trace, pos + nr < trace->nr_records ?
+			pos + nr : 0);
+	access->trace_prefetched = pos + nr;
 }
 
-static void do_rnd_wo(struct access *access)
+static inline size_t uniform_unit(struct access *access, size_t nr_units,
+		struct arnd *r)
 {
-	struct mregion *region = access->mregion;
-	char *rr = region->region;
-	int i;
+	return arnd_range(r, nr_units);
+}
 
-	for (i = 0; i < nr_accesses_per_region; i++)
-		ACCESS_ONCE(rr[rndint() % region->sz]) = 1;
+static inline size_t zipf_unit(struct access *access, size_t nr_units,
+		struct arnd *r)
+{
+	return avgn_zipf_val(&access->zipf, r) - 1;
 }
 
-static void do_seq_wo(struct access *access)
+static inline size_t hotset_unit(struct access *access, size_t nr_units,
+		struct arnd *r)
 {
-	struct mregion *region = access->mregion;
-	char *rr = region->region;
-	size_t offset = access->last_offset;
-	int i;
+	size_t hot_units = access->hot_units;
 
-	for (i = 0; i < nr_accesses_per_region; i++) {
-		offset += access->stride;
-		if (offset >= region->sz)
-			offset = 0;
-		ACCESS_ONCE(rr[offset]) = 1;
-	}
-	access->last_offset = offset;
+	if (arnd_next(r) < access->hot_threshold)
+		return arnd_range(r, hot_units);
+	return hot_units + arnd_range(r, nr_units - hot_units);
 }
 
-static void do_rnd_rw(struct access *access)
+/* Units out of the region are wrapped around */
+static inline size_t gauss_unit(struct access *access, size_t nr_units,
+		struct arnd *r)
 {
-	struct mregion *region = access->mregion;
-	char *rr = region->region;
-	int i;
-	char read_val;
+	long long unit;
+
+	unit = access->gauss_center + avgn_normal(r) * access->gauss_sigma;
+	while (unit < 0)
+		unit += nr_units;
+	while (unit >= nr_units)
+		unit -= nr_units;
+	return unit;
+}
 
-	for (i = 0; i < nr_accesses_per_region; i++) {
-		size_t rndoffset;
+DEFINE_WIDTH_OPS(byte, char, 1, u8, )
+DEFINE_WIDTH_OPS(word, uint64_t, 1, u64, )
+DEFINE_WIDTH_OPS(words2, uint64_t, 2, u64, )
+DEFINE_WIDTH_OPS(words4, uint64_t, 4, u64, )
+DEFINE_WIDTH_OPS(words8, uint64_t, 8, u64, )
 
-		rndoffset = rndint() % region->sz;
-		read_val = ACCESS_ONCE(rr[rndoffset]);
-		ACCESS_ONCE(rr[rndoffset]) = read_val + 1;
-	}
+DEFINE_WIDTH_KERNELS(byte, 1, )
+DEFINE_WIDTH_KERNELS(word, 8, )
+DEFINE_WIDTH_KERNELS(words2, 16, )
+DEFINE_WIDTH_KERNELS(words4, 32, )
+DEFINE_WIDTH_KERNELS(words8, 64, )
+
+#ifdef SIMD_KERNELS
+DEFINE_WIDTH_OPS(sse, __m128i, 1, m128, ATTR_SSE41)
+DEFINE_WIDTH_OPS(sse_x2, __m128i, 2, m128, ATTR_SSE41)
+DEFINE_WIDTH_OPS(sse_x4, __m128i, 4, m128, ATTR_SSE41)
+DEFINE_WIDTH_OPS(avx2, __m256i, 1, m256, ATTR_AVX2)
+DEFINE_WIDTH_OPS(avx2_x2, __m256i, 2, m256, ATTR_AVX2)
+DEFINE_WIDTH_OPS(avx512, __m512i, 1, m512, ATTR_AVX512)
+
+DEFINE_WIDTH_KERNELS(sse, 16, ATTR_SSE41)
+DEFINE_WIDTH_KERNELS(sse_x2, 32, ATTR_SSE41)
+DEFINE_WIDTH_KERNELS(sse_x4, 64, ATTR_SSE41)
+DEFINE_WIDTH_KERNELS(avx2, 32, ATTR_AVX2)
+DEFINE_WIDTH_KERNELS(avx2_x2, 64, ATTR_AVX2)
+DEFINE_WIDTH_KERNELS(avx512, 64, ATTR_AVX512)
+#endif
+
+/* kernels for each access width, indexed by log2 of the width */
+static const struct width_kernels *width_kernels[] = {
+	[0] = &byte_kernels,
+	[3] = &word_kernels,
+	[4] = &words2_kernels,
+	[5] = &words4_kernels,
+	[6] = &words8_kernels,
+};
+
+static inline const struct width_kernels *kernels_of(size_t width)
+{
+	return width_kernels[__builtin_ctzl(width)];
 }
 
-static void do_seq_rw(struct access *access)
+static const char *width_kernels_isa(size_t width)
 {
-	struct mregion *region = access->mregion;
-	char *rr = region->region;
-	size_t offset = access->last_offset;
-	int i;
-	char read_val;
+	return kernels_of(width)->isa;
+}
+
+/*
+ * Select the widest SIMD kernels that the CPU supports, so that one binary
+ * can run on all machines.
+ */
+static void init_width_kernels(void)
+{
+#ifdef SIMD_KERNELS
+	unsigned eax, ebx, ecx, edx;
+
+	/* CPUID.(EAX=07H, ECX=0H):EBX.CLFLUSHOPT[bit 23] */
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) ||
+			!(ebx & (1 << 23)))
+		no_clflushopt = 1;
 
-	for (i = 0; i < nr_accesses_per_region; i++) {
-		offset += access->stride;
-		if (offset >= region->sz)
-			offset = 0;
-		read_val = ACCESS_ONCE(rr[offset]);
-		ACCESS_ONCE(rr[offset]) = read_val + 1;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.1")) {
+		width_kernels[4] = &sse_kernels;
+		width_kernels[5] = &sse_x2_kernels;
+		width_kernels[6] = &sse_x4_kernels;
 	}
-	access->last_offset = offset;
+	if (__builtin_cpu_supports("avx2")) {
+		width_kernels[5] = &avx2_kernels;
+		width_kernels[6] = &avx2_x2_kernels;
+	}
+	if (__builtin_cpu_supports("avx512f"))
+		width_kernels[6] = &avx512_kernels;
+#endif
+}
+
+/*
+ * Chase kernels follow the chain of the region that build by
+ * build_chase_chain().  Each access is a load of the offset of the next link,
+ * which depends on the previous load, so the accesses cannot be overlapped by
+ * the CPU.
+ *
+ * The offsets are checked, because other access patterns could overwrite the
+ * chain.  The write modes write the first byte of the unit, using
+ * CHASE_OP_<rw>().
+ */
+#define CHASE_OP_ld(p)
+#define CHASE_OP_st(p)		(ACCESS_ONCE(*(p)) = 1)
+#define CHASE_OP_rmw(p)		(ACCESS_ONCE(*(p)) += 1)
+
+/*
+ * Return @next if it is the offset of a link of a unit in the region of @sz
+ * bytes, or the offset of the link of the first unit.
+ */
+static inline size_t chase_next(size_t next, size_t link_ofs, size_t stride,
+		size_t sz)
+{
+	if (next >= link_ofs && next + sizeof(size_t) <= sz &&
+			(next - link_ofs) % stride == 0)
+		return next;
+	return link_ofs;
+}
+
+/*
+ * do_chase_<rw>() follows one chain.  do_chase_multi_<rw>() follows
+ * @access->nr_chains chains in lockstep.  Loads of different chains are
+ * independent, so up to nr_chains misses can be outstanding together.
+ */
+#define DEFINE_CHASE_KERNELS(rw)					\
+static int do_chase_##rw(struct access *access)				\
+{									\
+	struct mregion *region = access->mregion;			\
+	char *rr = region->region;					\
+	size_t sz = region->sz;						\
+	size_t link_ofs = chase_link_offset(access->stride);		\
+	size_t offset = access->chase_offsets[0];			\
+	size_t next;							\
+	int nr = access->nr_chunk_accesses;				\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++) {					\
+		next = ACCESS_ONCE(*(size_t *)&rr[offset]);		\
+		CHASE_OP_##rw(&rr[offset - link_ofs]);			\
+		offset = chase_next(next, link_ofs, access->stride,	\
+				sz);					\
+	}								\
+	access->chase_offsets[0] = offset;				\
+	return nr;							\
+}									\
+									\
+static int do_chase_multi_##rw(struct access *access)			\
+{									\
+	struct mregion *region = access->mregion;			\
+	char *rr = region->region;					\
+	size_t sz = region->sz;						\
+	size_t link_ofs = chase_link_offset(access->stride);		\
+	int nr_chains = access->nr_chains;				\
+	size_t offsets[MAX_CHASE_CHAINS];				\
+	size_t next;							\
+	int nr = access->nr_chunk_accesses;				\
+	int i, j;							\
+									\
+	memcpy(offsets, access->chase_offsets,				\
+			sizeof(offsets[0]) * nr_chains);		\
+	for (i = 0; i + nr_chains <= nr; i += nr_chains) {		\
+		for (j = 0; j < nr_chains; j++) {			\
+			next = ACCESS_ONCE(*(size_t *)&rr[offsets[j]]);	\
+			CHASE_OP_##rw(&rr[offsets[j] - link_ofs]);	\
+			offsets[j] = chase_next(next, link_ofs,		\
+					access->stride, sz);		\
+		}							\
+	}								\
+	memcpy(access->chase_offsets, offsets,				\
+			sizeof(offsets[0]) * nr_chains);		\
+	return i;							\
 }
 
-static unsigned long long do_access(struct access *access)
+DEFINE_CHASE_KERNELS(ld)
+DEFINE_CHASE_KERNELS(st)
+DEFINE_CHASE_KERNELS(rmw)
+
+/* chase patterns support only ro, wo, and rw */
+static const access_fn chase_kernels[][READ_WRITE + 1] = {
+	{
+		[READ_ONLY] = do_chase_ld,
+		[WRITE_ONLY] = do_chase_st,
+		[READ_WRITE] = do_chase_rmw,
+	},
+	{
+		[READ_ONLY] = do_chase_multi_ld,
+		[WRITE_ONLY] = do_chase_multi_st,
+		[READ_WRITE] = do_chase_multi_rmw,
+	},
+};
+
+/*
+ * Returns the kernel for @a.  Should be called after the width kernels are
+ * initialized and all fields of @a are set.
+ */
+static access_fn access_fn_of(struct access *a)
 {
-	switch (access->rw_mode) {
-	case READ_ONLY:
-		if (access->random_access)
-			do_rnd_ro(access);
-		else
-			do_seq_ro(access);
-		break;
-	case WRITE_ONLY:
-		if (access->random_access)
-			do_rnd_wo(access);
-		else
-			do_seq_wo(access);
-		break;
-	case READ_WRITE:
-		if (access->random_access)
-			do_rnd_rw(access);
-		else
-			do_seq_rw(access);
-		break;
+	const struct width_kernels *kernels = kernels_of(a->width);
+	enum stride_class sclass;
+
+	sclass = a->stride && !(a->stride & (a->stride - 1)) ?
+		STRIDE_POW2 : STRIDE_ANY;
+	switch (a->order) {
+	case RANDOM:
+		return kernels->rnd[a->dist][sclass][a->rw_mode];
+	case SHUFFLE:
+		return kernels->shuffle[sclass][a->rw_mode];
+	case CHASE:
+		return chase_kernels[a->nr_chains > 1 || a->chains_sweep][
+			a->rw_mode];
+	case REPLAY:
+		return kernels->replay;
 	default:
-		break;
+		return kernels->seq[a->rw_mode];
 	}
-
-	return nr_accesses_per_region;
 }
 
-#define SZ_PAGE	4096
 void hint_access_pattern(struct phase *phase)
 {
 	static const unsigned MEMSZ_OFFSET = 10 * 1024 * 1024;	/* 10 MB */
@@ -310,424 +1050,3374 @@ void hint_access_pattern(struct phase *phase)
 		if (region->sz < MEMSZ_OFFSET)
 			continue;
 
-		if (acc->probability < freq_offset)
-			continue;
+		if (acc->probability < freq_offset)
+			continue;
+
+		if (hintmethod == MLOCK) {
+			if (mlock(region->region, region->sz) == -1)
+				err(-1, "failed mlock");
+		} else if (hintmethod == MADVISE) {
+			/* madvise receive page size aligned region only */
+			uintptr_t aligned;
+
+			aligned = (uintptr_t)region->region;
+			if (aligned % SZ_PAGE != 0)
+				aligned = aligned + SZ_PAGE -
+					(aligned % SZ_PAGE);
+
+			if (madvise((void *)aligned, region->sz,
+						MADV_WILLNEED) == -1)
+				err(-1, "failed madvise");
+		}
+	}
+}
+
+struct phase_exec;
+
+/* records of the accesses in each ring.  Should be a power of two */
+#define NR_RING_RECORDS	(1 << 16)
+
+/*
+ * Lock-free ring of the recorded accesses of a worker.  The worker is the only
+ * producer, and the flusher thread is the only consumer.  Records are dropped
+ * while the ring is full.  The records of a ring are in the order of the time,
+ * and @min_ts lets the flusher know until when the records of the rings can
+ * be merged in the order of the time.  @head and @tail are in different cache
+ * lines, so that the worker and the flusher don't bounce a cache line.
+ */
+struct record_ring {
+	unsigned long long head;	/* written by the worker */
+	/* records added later have the timestamps not smaller than this */
+	unsigned long long min_ts;
+	unsigned long long nr_dropped;
+	char pad[SZ_CACHELINE];
+	unsigned long long tail;	/* written by the flusher */
+	/* cursors that only the flusher uses while merging */
+	unsigned long long flush_head;
+	unsigned long long flush_tail;
+	struct mtr_record records[NR_RING_RECORDS];
+};
+
+/*
+ * A thread executing access patterns of a phase.  Workers are aligned to the
+ * cache line, so that the updates of a worker don't bounce the cache line of
+ * the others.
+ */
+struct worker {
+	struct athr thr;
+	struct phase_exec *exec;
+	/* private copies of the patterns this worker executes */
+	struct access *patterns;
+	int nr_patterns;
+	/* selects the pattern to execute.  NULL if only one pattern */
+	struct avgn_alias *alias;
+	unsigned long long nr_accesses;
+	/* recorded accesses.  NULL if not recording */
+	struct record_ring *ring;
+} __attribute__((aligned(SZ_CACHELINE)));
+
+struct phase_exec {
+	struct phase *phase;
+	/* sequence of the phase in the whole run */
+	unsigned seq;
+	struct worker *workers;
+	int nr_workers;
+	unsigned long long start;
+	unsigned long long cpu_cycle_ms;
+	/* overhead of aclk_clock() for the latency samples */
+	unsigned long long clock_overhead;
+	/* accesses or bytes done by all workers, for the work phases */
+	unsigned long long work_done;
+	/* writes the records of the rings of the workers to record_file */
+	struct athr flusher;
+	/* performance counters at the start and last log of the phase */
+	uint64_t perf_start[NR_APERF_EVENTS];
+	uint64_t perf_last[NR_APERF_EVENTS];
+};
+
+/*
+ * Counters of the workers are read by the leader for the progress logs and
+ * the interval stats while the workers are running.  Only the worker owning
+ * the counter writes it.
+ */
+static inline void add_stat(unsigned long long *stat, unsigned long long val)
+{
+	__atomic_store_n(stat, *stat + val, __ATOMIC_RELAXED);
+}
+
+static inline unsigned long long read_stat(unsigned long long *stat)
+{
+	return __atomic_load_n(stat, __ATOMIC_RELAXED);
+}
+
+static unsigned long long nr_workers_accesses(struct phase_exec *exec)
+{
+	unsigned long long nr_accesses = 0;
+	int i;
+
+	for (i = 0; i < exec->nr_workers; i++)
+		nr_accesses += read_stat(&exec->workers[i].nr_accesses);
+	return nr_accesses;
+}
+
+/*
+ * Returns the step of the chains sweep for the time @now.  The phase is
+ * evenly divided into NR_CHASE_SWEEP_STEPS steps.
+ */
+static int chase_sweep_step(struct phase_exec *exec, unsigned long long now)
+{
+	struct phase *phase = exec->phase;
+	unsigned long long step_cycles;
+	int step;
+
+	/* work phases are divided by the work */
+	if (phase->work) {
+		step = (double)ACCESS_ONCE(exec->work_done) /
+			phase->work * NR_CHASE_SWEEP_STEPS;
+		return step < NR_CHASE_SWEEP_STEPS ? step :
+			NR_CHASE_SWEEP_STEPS - 1;
+	}
+	step_cycles = exec->cpu_cycle_ms * exec->phase->time_ms /
+		NR_CHASE_SWEEP_STEPS;
+	if (!step_cycles)
+		return NR_CHASE_SWEEP_STEPS - 1;
+	step = (now - exec->start) / step_cycles;
+	if (step >= NR_CHASE_SWEEP_STEPS)
+		step = NR_CHASE_SWEEP_STEPS - 1;
+	return step;
+}
+
+/*
+ * The center of gaussian distribution starts from the middle of the region,
+ * and moves @pattern->gauss_speed regions per second, wrapping around.
+ */
+static void move_gauss_center(struct access *pattern, struct phase_exec *exec,
+		unsigned long long now)
+{
+	size_t nr_units = pattern->mregion->sz / pattern->stride;
+	double secs = (double)(now - exec->start) / exec->cpu_cycle_ms / 1000;
+	double pos = 0.5 + pattern->gauss_speed * secs;
+
+	pattern->gauss_center = (pos - floor(pos)) * nr_units;
+	if (pattern->gauss_center >= nr_units)
+		pattern->gauss_center = nr_units - 1;
+}
+
+/*
+ * Let the flusher know that the records that @worker will add have the
+ * timestamps not smaller than @ts.
+ */
+static void set_record_min_ts(struct worker *worker, unsigned long long ts)
+{
+	if (worker->ring)
+		__atomic_store_n(&worker->ring->min_ts, ts, __ATOMIC_RELEASE);
+}
+
+/*
+ * Wait until @due for @pattern, or the deadline of the phase.  Long waits are
+ * made with sleeps, and the remaining short time is spun.
+ */
+static void wait_pattern(struct worker *worker, struct access *pattern,
+		unsigned long long due)
+{
+	struct phase_exec *exec = worker->exec;
+	unsigned long long cpu_cycle_ms = exec->cpu_cycle_ms;
+	unsigned long long now, deadline, ns;
+	struct timespec ts;
+
+	now = aclk_clock();
+	deadline = exec->start + cpu_cycle_ms * exec->phase->time_ms;
+	if (exec->phase->time_ms && due > deadline)
+		due = deadline;
+	if (now >= due)
+		return;
+	set_record_min_ts(worker, due);
+	/* leave 100 us for the wakeup latency */
+	if (due - now > cpu_cycle_ms / 5) {
+		ns = (due - now - cpu_cycle_ms / 10) * 1000000 / cpu_cycle_ms;
+		ts.tv_sec = ns / 1000000000;
+		ts.tv_nsec = ns % 1000000000;
+		nanosleep(&ts, NULL);
+	}
+	while (aclk_clock() < due)
+		cpu_relax();
+	add_stat(&pattern->idle_cycles, aclk_clock() - now);
+}
+
+/*
+ * Wait until the next chunk of the rate limited @pattern is due.  The chunks
+ * are due in the fixed interval from the start of the phase regardless of
+ * when the previous chunks completed (open loop), so late chunks are executed
+ * immediately.
+ */
+static void pace_pattern(struct worker *worker, struct access *pattern)
+{
+	struct phase_exec *exec = worker->exec;
+
+	wait_pattern(worker, pattern, exec->start +
+			pattern->nr_accesses * pattern->cycles_per_access);
+}
+
+/*
+ * Wait until the next record of the timestamp-paced replay @pattern is due,
+ * and let the kernel replay the records that due until now.  The first
+ * record is due at the start of the phase.  Like pace_pattern(), late
+ * records are replayed immediately.
+ */
+static void pace_replay(struct worker *worker, struct access *pattern)
+{
+	struct phase_exec *exec = worker->exec;
+	struct mtrace *trace = pattern->trace;
+	double ns_per_cycle = 1000000.0 / exec->cpu_cycle_ms;
+	double speed = pattern->trace_speed;
+	uint64_t now_ns, next_ns;
+	size_t pos = pattern->trace_pos;
+	uint64_t base = pattern->trace_base;
+
+	if (pos >= trace->nr_records) {
+		pos %= trace->nr_records;
+		base += trace->period_ns;
+	}
+	next_ns = base + trace->records[pos].ts_ns;
+	now_ns = trace->start_ns +
+		(aclk_clock() - exec->start) * ns_per_cycle * speed;
+	if (next_ns > now_ns) {
+		wait_pattern(worker, pattern, exec->start + (next_ns -
+					trace->start_ns) / speed / ns_per_cycle);
+		now_ns = next_ns;
+	}
+	pattern->trace_until = now_ns;
+}
+
+/*
+ * Time one access of @pattern for every lat_sample_interval accesses made,
+ * by calling the kernel for only one access between the clock reads that
+ * serialized with the access.  Chase patterns having multiple
+ * chains make one access per chain together.  @nr_made is the number of the
+ * accesses made after the last call.
+ *
+ * Returns the number of the accesses made for the sampling.
+ */
+static unsigned long long sample_latency(struct access *pattern,
+		unsigned long long nr_made, struct phase_exec *exec)
+{
+	int nr_chunk_accesses = pattern->nr_chunk_accesses;
+	unsigned long long start, lat, nr = 0;
+
+	pattern->nr_unsampled += nr_made;
+	pattern->nr_chunk_accesses = pattern->order == CHASE ?
+		pattern->nr_chains : 1;
+	while (pattern->nr_unsampled >= lat_sample_interval) {
+		pattern->nr_unsampled -= lat_sample_interval;
+		start = aclk_start();
+		nr += pattern->fn(pattern);
+		lat = aclk_end() - start;
+		ahist_add(pattern->lat_hist, lat > exec->clock_overhead ?
+				lat - exec->clock_overhead : 0);
+	}
+	pattern->nr_chunk_accesses = nr_chunk_accesses;
+	return nr;
+}
+
+/* Add @rec to @ring, or drop it if @ring is full */
+static void push_record(struct record_ring *ring, struct mtr_record *rec)
+{
+	unsigned long long head = ring->head;
+
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >=
+			NR_RING_RECORDS) {
+		ring->nr_dropped++;
+		return;
+	}
+	ring->records[head % NR_RING_RECORDS] = *rec;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Make the next access of @pattern by calling the kernel for only one access,
+ * and record it to the ring of @worker.  The address of the access is decided
+ * from the state of the pattern, before or after the call.  Chase patterns
+ * having multiple chains make one access per chain together, and the access
+ * of the first chain is recorded.
+ *
+ * Returns the number of the accesses made.
+ */
+static int record_access(struct worker *worker, struct access *pattern)
+{
+	int nr_chunk_accesses = pattern->nr_chunk_accesses;
+	struct mregion *region = pattern->mregion;
+	struct mtr_record rec;
+	struct mtr_record *trace_rec = NULL;
+	struct mtrace *trace;
+	struct arnd r = rnd;
+	size_t nr_units, offset = 0;
+	int nr;
+
+	switch (pattern->order) {
+	case RANDOM:
+		/* the kernel makes the same random unit from the copy */
+		nr_units = region->sz / pattern->stride;
+		switch (pattern->dist) {
+		case ZIPF:
+			offset = zipf_unit(pattern, nr_units, &r);
+			break;
+		case HOTSET:
+			offset = hotset_unit(pattern, nr_units, &r);
+			break;
+		case GAUSSIAN:
+			offset = gauss_unit(pattern, nr_units, &r);
+			break;
+		default:
+			offset = uniform_unit(pattern, nr_units, &r);
+			break;
+		}
+		offset = offset * pattern->stride + pattern->unit_offset;
+		break;
+	case CHASE:
+		offset = pattern->chase_offsets[0];
+		break;
+	case REPLAY:
+		trace = pattern->trace;
+		trace_rec = &trace->records[pattern->trace_pos %
+			trace->nr_records];
+		region = &trace->regions[trace_rec->region %
+			trace->nr_regions];
+		offset = trace_rec->offset;
+		if (offset > region->sz - pattern->width)
+			offset %= region->sz - pattern->width + 1;
+		offset &= ~(pattern->width - 1);
+		break;
+	default:
+		break;
+	}
+
+	pattern->nr_chunk_accesses = pattern->order == CHASE ?
+		pattern->nr_chains : 1;
+	rec.ts_ns = aclk_clock();
+	nr = pattern->fn(pattern);
+	pattern->nr_chunk_accesses = nr_chunk_accesses;
+	if (!nr)
+		return 0;
+
+	if (pattern->order == SEQUENTIAL)
+		offset = pattern->last_offset;
+	else if (pattern->order == SHUFFLE)
+		offset = avgn_perm_val(&pattern->perm, pattern->shuffle_pos -
+				pattern->shuffle_step) * pattern->stride +
+			pattern->unit_offset;
+	rec.offset = offset;
+	rec.region = region - record_regions;
+	if (pattern->order == REPLAY)
+		rec.write = trace_rec->write;
+	else
+		rec.write = pattern->rw_mode != READ_ONLY &&
+			pattern->rw_mode != NT_READ_ONLY;
+	push_record(worker->ring, &rec);
+	return nr;
+}
+
+/*
+ * Make a chunk of the accesses of @pattern while recording one of every
+ * record_interval accesses.  The chunk is split at the recorded accesses, so
+ * that the records are evenly distributed over the accesses.  Only the time
+ * for the recorded accesses is accounted as the time for the recording.
+ *
+ * Returns the number of the accesses made.
+ */
+static int exec_recorded(struct worker *worker, struct access *pattern)
+{
+	int nr_chunk_accesses = pattern->nr_chunk_accesses;
+	int granularity = pattern->order == CHASE ? pattern->nr_chains : 1;
+	unsigned long long start;
+	int nr = 0, nr_sub, made;
+
+	while (nr < nr_chunk_accesses) {
+		nr_sub = record_interval - 1 - pattern->nr_unrecorded;
+		if (nr_sub > nr_chunk_accesses - nr)
+			nr_sub = nr_chunk_accesses - nr;
+		nr_sub -= nr_sub % granularity;
+		if (nr_sub) {
+			pattern->nr_chunk_accesses = nr_sub;
+			made = pattern->fn(pattern);
+			pattern->nr_chunk_accesses = nr_chunk_accesses;
+			nr += made;
+			pattern->nr_unrecorded += made;
+			/* the rest of the chunk or the replay is not due */
+			if (made < nr_sub ||
+					pattern->nr_unrecorded < record_interval - 1)
+				break;
+		}
+		start = aclk_clock();
+		made = record_access(worker, pattern);
+		add_stat(&pattern->record_cycles, aclk_clock() - start);
+		if (!made)
+			break;
+		nr += made;
+		add_stat(&pattern->nr_recorded, 1);
+		pattern->nr_unrecorded = 0;
+	}
+	return nr;
+}
+
+/* Bytes that each access of @pattern transfers */
+static size_t access_bytes(struct access *pattern)
+{
+	return pattern->order == CHASE ? SZ_CACHELINE : pattern->width;
+}
+
+/*
+ * Add @done accesses or bytes to the work done in the phase, and stop all
+ * workers if the work of the phase is done.
+ */
+static void account_work(struct phase_exec *exec, unsigned long long done)
+{
+	int i;
+
+	if (__atomic_add_fetch(&exec->work_done, done, __ATOMIC_RELAXED) <
+			exec->phase->work)
+		return;
+	for (i = 0; i < exec->nr_workers; i++)
+		athr_stop(&exec->workers[i].thr);
+}
+
+static void exec_pattern(struct worker *worker, struct access *pattern)
+{
+	struct phase_exec *exec = worker->exec;
+	unsigned long long nr, busy_start, busy;
+	int step = 0;
+
+	set_record_min_ts(worker, aclk_clock());
+	if (pattern->rate)
+		pace_pattern(worker, pattern);
+	if (pattern->trace_speed)
+		pace_replay(worker, pattern);
+	busy_start = aclk_clock();
+	if (pattern->dist == GAUSSIAN)
+		move_gauss_center(pattern, exec, busy_start);
+	if (pattern->chains_sweep) {
+		step = chase_sweep_step(exec, busy_start);
+		pattern->nr_chains = 1 << step;
+	}
+	nr = worker->ring ? exec_recorded(worker, pattern) :
+		pattern->fn(pattern);
+	if (pattern->lat_hist)
+		nr += sample_latency(pattern, nr, exec);
+	busy = aclk_clock() - busy_start;
+	add_stat(&pattern->busy_cycles, busy);
+	add_stat(&pattern->nr_accesses, nr);
+	if (pattern->chains_sweep) {
+		add_stat(&pattern->sweep_accesses[step], nr);
+		add_stat(&pattern->sweep_cycles[step], busy);
+	}
+	add_stat(&worker->nr_accesses, nr);
+	if (exec->phase->work)
+		account_work(exec, exec->phase->work_in_bytes ?
+				nr * access_bytes(pattern) : nr);
+}
+
+/*
+ * Print the performance counter values increased from @before to @after,
+ * with the ratios that help understanding the accesses.
+ */
+static void pr_perf(const char *name, uint64_t *before, uint64_t *after,
+		unsigned long long nr_accesses)
+{
+	uint64_t vals[NR_APERF_EVENTS];
+	int i;
+
+	for (i = 0; i < NR_APERF_EVENTS; i++) {
+		vals[i] = APERF_NA;
+		if (before[i] != APERF_NA && after[i] != APERF_NA)
+			vals[i] = after[i] - before[i];
+	}
+	printf("%s:\t", name);
+	for (i = 0; i < NR_APERF_EVENTS; i++) {
+		if (vals[i] == APERF_NA) {
+			printf("%s n/a", aperf_event_names[i]);
+		} else {
+			printf("%s %'llu", aperf_event_names[i],
+					(unsigned long long)vals[i]);
+			if ((i == APERF_LLC_MISSES || i == APERF_DTLB_MISSES) &&
+					nr_accesses)
+				printf(" (%.2f / 1k accesses)",
+						1000.0 * vals[i] / nr_accesses);
+			if (i == APERF_STALLED_BACKEND &&
+					vals[APERF_CYCLES] != APERF_NA &&
+					vals[APERF_CYCLES])
+				printf(" (%.1f%%)", 100.0 * vals[i] /
+						vals[APERF_CYCLES]);
+		}
+		printf(i < NR_APERF_EVENTS - 1 ? ", " : "");
+	}
+	if (vals[APERF_CYCLES] != APERF_NA && vals[APERF_CYCLES] &&
+			vals[APERF_INSTRUCTIONS] != APERF_NA)
+		printf(", IPC %.2f", (double)vals[APERF_INSTRUCTIONS] /
+				vals[APERF_CYCLES]);
+	printf("\n");
+}
+
+static void sum_workers_stats(struct phase_exec *exec);
+static void pr_stats(struct phase_exec *exec, const char *type,
+		unsigned long long now);
+
+/*
+ * The first worker is the leader.  The leader logs the progress of the phase
+ * and stops all workers at the deadline, so that the workers stop together.
+ */
+static void *run_worker(void *arg)
+{
+	struct athr_arg *athr_arg = arg;
+	struct worker *worker = athr_arg->thr_arg;
+	struct phase_exec *exec = worker->exec;
+	struct phase *phase = exec->phase;
+	unsigned long long nr_last_logged_access = 0;
+	unsigned long long now, last_log_time;
+	unsigned long long cpu_cycle_ms = exec->cpu_cycle_ms;
+	int leader = worker == &exec->workers[0];
+	int i;
+
+	arnd_seed(&rnd, rnd_seed ^ ((uint64_t)exec->seq << 32) ^
+			(worker - exec->workers));
+	last_log_time = exec->start;
+	while (!ACCESS_ONCE(athr_arg->stop)) {
+		if (worker->alias)
+			exec_pattern(worker, &worker->patterns[
+					avgn_alias_val(worker->alias, &rnd)]);
+		else if (worker->nr_patterns)
+			exec_pattern(worker, &worker->patterns[0]);
+
+		if (!leader)
+			continue;
+
+		now = aclk_clock();
+		if (log_interval_ms && now - last_log_time >
+				cpu_cycle_ms * log_interval_ms) {
+			unsigned long long nr_access;
+
+			nr_access = nr_workers_accesses(exec);
+			if (!quiet)
+				printf("%s:\t%'20llu accesses / %d msec\n",
+						phase->name,
+						nr_access -
+						nr_last_logged_access,
+						log_interval_ms);
+			if (!quiet && perf_enabled) {
+				uint64_t vals[NR_APERF_EVENTS];
+
+				aperf_read(&perf, vals);
+				pr_perf(phase->name, exec->perf_last, vals,
+						nr_access -
+						nr_last_logged_access);
+				memcpy(exec->perf_last, vals, sizeof(vals));
+			}
+			if (stats_file) {
+				sum_workers_stats(exec);
+				pr_stats(exec, "interval", now);
+			}
+			last_log_time = now;
+			nr_last_logged_access = nr_access;
+		}
+		if ((!phase->work || phase->time_ms) &&
+				now - exec->start > cpu_cycle_ms * phase->time_ms) {
+			for (i = 0; i < exec->nr_workers; i++)
+				athr_stop(&exec->workers[i].thr);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Set the starting points of the chains that @idx-th one of @nr threads
+ * follows.  The chains start from different units that evenly distributed
+ * over the region, so that they never meet.
+ */
+static void setup_chase_offsets(struct access *pattern, int idx, int nr)
+{
+	size_t stride = pattern->stride;
+	size_t nr_units = pattern->mregion->sz / stride;
+	size_t nr_starts = MAX_CHASE_CHAINS * nr;
+	size_t unit, start;
+	int i;
+
+	for (i = 0; i < MAX_CHASE_CHAINS; i++) {
+		/* nr_units * start / nr_starts, without the overflow */
+		start = i * nr + idx;
+		unit = nr_units / nr_starts * start +
+			nr_units % nr_starts * start / nr_starts;
+		pattern->chase_offsets[i] = unit * stride +
+			chase_link_offset(stride);
+	}
+}
+
+/*
+ * Set the first epoch of the shuffle that @idx-th one of @nr threads
+ * executes.  The threads use same permutation for each epoch and visit
+ * different units of the permutation, so that each unit is accessed once per
+ * epoch by all the threads.
+ */
+static void setup_shuffle(struct access *pattern, struct phase_exec *exec,
+		int idx, int nr)
+{
+	size_t nr_units = pattern->mregion->sz / pattern->stride;
+
+	pattern->perm_seed = rnd_seed ^ ((uint64_t)exec->seq << 32) ^
+		((uint64_t)pattern->idx << 16);
+	pattern->shuffle_epoch = 0;
+	avgn_perm_init(&pattern->perm, nr_units, pattern->perm_seed);
+	pattern->shuffle_first = idx % nr_units;
+	pattern->shuffle_step = nr;
+	pattern->shuffle_pos = pattern->shuffle_first;
+}
+
+/*
+ * Set the replay that @idx-th one of @nr threads executes.  The threads
+ * replay the records of the trace in turn, from the beginning of the trace.
+ */
+static void setup_replay(struct access *pattern, int idx, int nr)
+{
+	pattern->trace_pos = idx;
+	pattern->trace_step = nr;
+	pattern->trace_prefetched = 0;
+	pattern->trace_base = 0;
+	pattern->trace_until = pattern->trace_speed ? 0 : UINT64_MAX;
+	/* the first window, which replays start from */
+	if (!idx)
+		advise_trace_window(pattern->trace, 0);
+}
+
+/*
+ * Set @worker to execute @pattern as @idx-th one of @nr threads that execute
+ * the pattern.  Sequential accesses of the threads start from different
+ * offsets of the region, so that the threads don't walk the same cache lines
+ * together.
+ */
+static void setup_worker_pattern(struct access *pattern,
+		struct phase_exec *exec, int idx, int nr)
+{
+	size_t sz = pattern->mregion->sz;
+	size_t offset;
+
+	offset = sz / nr * idx;
+	if (pattern->stride)
+		offset -= offset % pattern->stride;
+	pattern->last_offset = offset;
+	if (pattern->rate)
+		pattern->cycles_per_access = (double)exec->cpu_cycle_ms * nr /
+			pattern->rate;
+	if (pattern->order == CHASE)
+		setup_chase_offsets(pattern, idx, nr);
+	else if (pattern->order == SHUFFLE)
+		setup_shuffle(pattern, exec, idx, nr);
+	else if (pattern->order == REPLAY)
+		setup_replay(pattern, idx, nr);
+}
+
+static void reset_pattern_stats(struct access *pattern)
+{
+	pattern->nr_accesses = 0;
+	pattern->busy_cycles = 0;
+	pattern->idle_cycles = 0;
+	pattern->nr_unsampled = 0;
+	pattern->nr_unrecorded = 0;
+	pattern->nr_recorded = 0;
+	pattern->record_cycles = 0;
+	pattern->nr_workers = 0;
+	memset(pattern->sweep_accesses, 0, sizeof(pattern->sweep_accesses));
+	memset(pattern->sweep_cycles, 0, sizeof(pattern->sweep_cycles));
+}
+
+/*
+ * Sum per-pattern statistics of the workers into the patterns of the phase.
+ * The workers could be running, for the interval stats.
+ */
+static void sum_workers_stats(struct phase_exec *exec)
+{
+	struct phase *phase = exec->phase;
+	struct access *pattern, *orig;
+	struct worker *worker;
+	unsigned long long nr_accesses;
+	int i, j, k;
+
+	for (i = 0; i < phase->nr_patterns; i++)
+		reset_pattern_stats(&phase->patterns[i]);
+	for (i = 0; i < exec->nr_workers; i++) {
+		worker = &exec->workers[i];
+		for (j = 0; j < worker->nr_patterns; j++) {
+			pattern = &worker->patterns[j];
+			nr_accesses = read_stat(&pattern->nr_accesses);
+			if (!nr_accesses)
+				continue;
+			orig = &phase->patterns[pattern->idx];
+			orig->nr_accesses += nr_accesses;
+			orig->busy_cycles += read_stat(&pattern->busy_cycles);
+			orig->idle_cycles += read_stat(&pattern->idle_cycles);
+			orig->nr_recorded += read_stat(&pattern->nr_recorded);
+			orig->record_cycles +=
+				read_stat(&pattern->record_cycles);
+			orig->nr_workers++;
+			for (k = 0; k < NR_CHASE_SWEEP_STEPS; k++) {
+				orig->sweep_accesses[k] += read_stat(
+						&pattern->sweep_accesses[k]);
+				orig->sweep_cycles[k] += read_stat(
+						&pattern->sweep_cycles[k]);
+			}
+		}
+	}
+}
+
+static void setup_worker(struct worker *worker, struct phase_exec *exec,
+		struct access *patterns, int nr_patterns, int *cpus,
+		int nr_cpus, int idx)
+{
+	int i;
+
+	worker->exec = exec;
+	worker->thr.cpu = nr_cpus ? cpus[idx % nr_cpus] : -1;
+	worker->thr.arg.thr_arg = worker;
+	worker->patterns = malloc(sizeof(*patterns) * nr_patterns);
+	if (!worker->patterns)
+		err(1, "worker patterns alloc");
+	memcpy(worker->patterns, patterns, sizeof(*patterns) * nr_patterns);
+	for (i = 0; i < nr_patterns; i++) {
+		reset_pattern_stats(&worker->patterns[i]);
+		worker->patterns[i].lat_hist = NULL;
+		if (!lat_sample_interval)
+			continue;
+		worker->patterns[i].lat_hist = calloc(1, sizeof(struct ahist));
+		if (!worker->patterns[i].lat_hist)
+			err(1, "latency histogram alloc");
+	}
+	worker->nr_patterns = nr_patterns;
+	worker->alias = NULL;
+	worker->nr_accesses = 0;
+	worker->ring = NULL;
+	if (record_file) {
+		worker->ring = calloc(1, sizeof(*worker->ring));
+		if (!worker->ring)
+			err(1, "record ring alloc");
+		/* workers having no pattern never add records */
+		if (!nr_patterns)
+			worker->ring->min_ts = -1ULL;
+	}
+}
+
+/*
+ * Build the workers for @phase.  The phase threads execute the patterns
+ * having no dedicated thread, with the probabilities.  Patterns having
+ * dedicated threads are executed by only their threads.
+ */
+static void setup_workers(struct phase_exec *exec)
+{
+	struct phase *phase = exec->phase;
+	struct access *pattern;
+	struct worker *worker;
+	int nr_shared_threads;
+	int i, j;
+
+	nr_shared_threads = phase->total_probability ? phase->nr_threads : 0;
+	exec->nr_workers = nr_shared_threads;
+	for (i = 0; i < phase->nr_patterns; i++)
+		exec->nr_workers += phase->patterns[i].nr_threads;
+	if (!exec->nr_workers)
+		exec->nr_workers = 1;
+	if (posix_memalign((void **)&exec->workers, SZ_CACHELINE,
+				sizeof(*exec->workers) * exec->nr_workers))
+		err(1, "workers alloc");
+	memset(exec->workers, 0, sizeof(*exec->workers) * exec->nr_workers);
+
+	for (i = 0; i < nr_shared_threads; i++) {
+		worker = &exec->workers[i];
+		setup_worker(worker, exec, phase->patterns, phase->nr_patterns,
+				phase->cpus, phase->nr_cpus, i);
+		worker->alias = &phase->alias;
+		for (j = 0; j < worker->nr_patterns; j++) {
+			pattern = &worker->patterns[j];
+			if (!pattern->nr_threads)
+				setup_worker_pattern(pattern, exec, i,
+						nr_shared_threads);
+		}
+	}
+
+	worker = &exec->workers[nr_shared_threads];
+	for (i = 0; i < phase->nr_patterns; i++) {
+		pattern = &phase->patterns[i];
+		for (j = 0; j < pattern->nr_threads; j++, worker++) {
+			setup_worker(worker, exec, pattern, 1, pattern->cpus,
+					pattern->nr_cpus, j);
+			setup_worker_pattern(&worker->patterns[0], exec, j,
+					pattern->nr_threads);
+		}
+	}
+
+	/* no pattern to execute.  Just wait for the deadline */
+	if (!nr_shared_threads && worker == exec->workers) {
+		setup_worker(worker, exec, NULL, 0, phase->cpus,
+				phase->nr_cpus, 0);
+	}
+
+}
+
+static void cleanup_workers(struct phase_exec *exec)
+{
+	struct worker *worker;
+	int i, j;
+
+	for (i = 0; i < exec->nr_workers; i++) {
+		worker = &exec->workers[i];
+		for (j = 0; j < worker->nr_patterns; j++)
+			free(worker->patterns[j].lat_hist);
+		free(worker->patterns);
+		free(worker->ring);
+	}
+	free(exec->workers);
+}
+
+/*
+ * Print the latency and the bandwidth of chasing with @nr_chains chains,
+ * that made @nr_accesses accesses in @cycles of the @nr_workers workers.
+ */
+static void pr_chase_perf(struct phase *phase, int idx, int nr_chains,
+		unsigned long long nr_accesses, unsigned long long cycles,
+		int nr_workers, unsigned long long cpu_cycle_ms)
+{
+	double ns = cycles * 1000000.0 / cpu_cycle_ms;
+
+	printf("%s:\tpattern %d (%s) %2d chains: %8.2f ns/access, "
+			"%10.2f MiB/s\n",
+			phase->name, idx, phase->patterns[idx].mregion->name,
+			nr_chains, ns * nr_chains / nr_accesses,
+			nr_accesses * SZ_CACHELINE * nr_workers /
+			(ns / 1000000000) / (1 << 20));
+}
+
+/*
+ * Print the load-to-use latency and the achieved bandwidth that measured by
+ * the chasing patterns.  The bandwidth is the sum of the workers, assuming
+ * the workers were running in parallel.
+ */
+static void pr_chase_latency(struct phase *phase,
+		unsigned long long cpu_cycle_ms)
+{
+	struct access *pattern;
+	int i, j;
+
+	for (i = 0; i < phase->nr_patterns; i++) {
+		pattern = &phase->patterns[i];
+		if (pattern->order != CHASE || !pattern->nr_accesses)
+			continue;
+		if (!pattern->chains_sweep) {
+			pr_chase_perf(phase, i, pattern->nr_chains,
+					pattern->nr_accesses,
+					pattern->busy_cycles,
+					pattern->nr_workers, cpu_cycle_ms);
+			continue;
+		}
+		for (j = 0; j < NR_CHASE_SWEEP_STEPS; j++) {
+			if (!pattern->sweep_accesses[j])
+				continue;
+			pr_chase_perf(phase, i, 1 << j,
+					pattern->sweep_accesses[j],
+					pattern->sweep_cycles[j],
+					pattern->nr_workers, cpu_cycle_ms);
+		}
+	}
+}
+
+/*
+ * Print how many times the shuffle patterns passed all the units of the
+ * regions.
+ */
+static void pr_shuffle_passes(struct phase *phase)
+{
+	struct access *pattern;
+	size_t nr_units;
+	int i;
+
+	for (i = 0; i < phase->nr_patterns; i++) {
+		pattern = &phase->patterns[i];
+		if (pattern->order != SHUFFLE || !pattern->nr_accesses)
+			continue;
+		nr_units = pattern->mregion->sz / pattern->stride;
+		printf("%s:\tpattern %d (%s) %.2f passes of %zu units, "
+				"%'llu bytes accessed\n",
+				phase->name, i, pattern->mregion->name,
+				(double)pattern->nr_accesses / nr_units,
+				nr_units, pattern->nr_accesses *
+				pattern->width);
+	}
+}
+
+/*
+ * Warn if the median sampled latency @p50_ns of @idx-th pattern of the phase
+ * is far from the average latency of the chasing, as those should be similar
+ * for the chase patterns following one chain.
+ */
+static void check_chase_latency(struct phase_exec *exec, int idx,
+		double p50_ns)
+{
+	struct access *pattern = &exec->phase->patterns[idx];
+	double avg_ns;
+
+	if (pattern->order != CHASE || pattern->nr_chains != 1 ||
+			pattern->chains_sweep || !pattern->nr_accesses)
+		return;
+	avg_ns = pattern->busy_cycles * 1000000.0 / exec->cpu_cycle_ms /
+		pattern->nr_accesses;
+	if (p50_ns < avg_ns / 2 || p50_ns > avg_ns * 2)
+		warnx("%s: p50 latency %.1f ns of pattern %d is far from "
+				"%.1f ns/access of the chasing",
+				exec->phase->name, p50_ns, idx, avg_ns);
+}
+
+/*
+ * Print the percentiles of the sampled latencies of each pattern, merging the
+ * histograms of the workers.
+ */
+static void pr_latency(struct phase_exec *exec)
+{
+	static const double percentiles[] = {50, 90, 99, 99.9};
+	struct phase *phase = exec->phase;
+	double ns_per_cycle = 1000000.0 / exec->cpu_cycle_ms;
+	struct access *pattern;
+	struct worker *worker;
+	struct ahist *hist;
+	int i, j, k;
+
+	hist = malloc(sizeof(*hist));
+	if (!hist)
+		err(1, "latency histogram alloc");
+	for (i = 0; i < phase->nr_patterns; i++) {
+		memset(hist, 0, sizeof(*hist));
+		for (j = 0; j < exec->nr_workers; j++) {
+			worker = &exec->workers[j];
+			for (k = 0; k < worker->nr_patterns; k++) {
+				pattern = &worker->patterns[k];
+				if (pattern->idx == i && pattern->lat_hist)
+					ahist_merge(hist, pattern->lat_hist);
+			}
+		}
+		if (!hist->nr_values)
+			continue;
+		printf("%s:\tpattern %d (%s) latency", phase->name, i,
+				phase->patterns[i].mregion->name);
+		for (k = 0; k < LEN_ARRAY(percentiles); k++)
+			printf(" p%g %.1f ns,", percentiles[k],
+					ahist_percentile(hist, percentiles[k]) *
+					ns_per_cycle);
+		printf(" %llu samples\n", (unsigned long long)hist->nr_values);
+		check_chase_latency(exec, i, ahist_percentile(hist, 50) *
+				ns_per_cycle);
+	}
+	free(hist);
+}
+
+/*
+ * Get the bytes that @pattern read and wrote.  Reads of the chase patterns
+ * include the loads of the links.
+ */
+static void pattern_rw_bytes(struct access *pattern,
+		unsigned long long *bytes_read,
+		unsigned long long *bytes_written)
+{
+	unsigned long long bytes = pattern->nr_accesses * access_bytes(pattern);
+	int reads = 0, writes = 0;
+
+	switch (pattern->rw_mode) {
+	case READ_ONLY:
+	case NT_READ_ONLY:
+		reads = 1;
+		break;
+	case WRITE_ONLY:
+	case NT_WRITE_ONLY:
+	case FLUSH_WRITE_ONLY:
+		writes = 1;
+		break;
+	default:
+		reads = writes = 1;
+		break;
+	}
+	if (pattern->order == CHASE)
+		reads = 1;
+	*bytes_read = reads ? bytes : 0;
+	*bytes_written = writes ? bytes : 0;
+}
+
+static void pr_json_str(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', f);
+		if ((unsigned char)*str < 0x20)
+			fprintf(f, "\\u%04x", *str);
+		else
+			fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+static void pr_csv_str(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str; str++) {
+		if (*str == '"')
+			fputc('"', f);
+		fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+static void pr_stats_csv_header(void)
+{
+	fprintf(stats_file, "type,phase,seq,elapsed_us,nr_threads,pattern,"
+			"region,accesses,bytes_read,bytes_written,busy_ns\n");
+}
+
+/*
+ * Write the statistics of the patterns of the phase to stats_file.  @type is
+ * "interval" for the periodic records, or "phase" for the end of the phase.
+ * The numbers are written as integers, to be free from the locale.  The
+ * statistics of the phase's patterns should be summed before the call.
+ */
+static void pr_stats(struct phase_exec *exec, const char *type,
+		unsigned long long now)
+{
+	struct phase *phase = exec->phase;
+	unsigned long long cpu_cycle_ms = exec->cpu_cycle_ms;
+	unsigned long long elapsed_us, busy_ns, bytes_read, bytes_written;
+	struct access *pattern;
+	int i;
+
+	elapsed_us = (now - exec->start) * 1000 / cpu_cycle_ms;
+	if (stats_format == STATS_JSON) {
+		fprintf(stats_file, "{\"type\": \"%s\", \"phase\": ", type);
+		pr_json_str(stats_file, phase->name);
+		fprintf(stats_file, ", \"seq\": %u, \"elapsed_us\": %llu, "
+				"\"nr_threads\": %d, \"patterns\": [",
+				exec->seq, elapsed_us, exec->nr_workers);
+	}
+	for (i = 0; i < phase->nr_patterns; i++) {
+		pattern = &phase->patterns[i];
+		pattern_rw_bytes(pattern, &bytes_read, &bytes_written);
+		busy_ns = (double)pattern->busy_cycles * 1000000 /
+			cpu_cycle_ms;
+		if (stats_format == STATS_CSV) {
+			fprintf(stats_file, "%s,", type);
+			pr_csv_str(stats_file, phase->name);
+			fprintf(stats_file, ",%u,%llu,%d,%d,", exec->seq,
+					elapsed_us, exec->nr_workers, i);
+			pr_csv_str(stats_file, pattern->mregion->name);
+			fprintf(stats_file, ",%llu,%llu,%llu,%llu\n",
+					pattern->nr_accesses, bytes_read,
+					bytes_written, busy_ns);
+			continue;
+		}
+		fprintf(stats_file, "%s{\"pattern\": %d, \"region\": ",
+				i ? ", " : "", i);
+		pr_json_str(stats_file, pattern->mregion->name);
+		fprintf(stats_file, ", \"accesses\": %llu, "
+				"\"bytes_read\": %llu, "
+				"\"bytes_written\": %llu, \"busy_ns\": %llu}",
+				pattern->nr_accesses, bytes_read,
+				bytes_written, busy_ns);
+	}
+	if (stats_format == STATS_JSON)
+		fprintf(stats_file, "]}\n");
+	fflush(stats_file);
+}
+
+/*
+ * Print the achieved rate of the rate limited patterns and the portion of the
+ * time that the threads of the patterns spent for waiting.
+ */
+static void pr_rates(struct phase *phase, unsigned long long runtime_ms,
+		unsigned long long cpu_cycle_ms)
+{
+	struct access *pattern;
+	double rate;
+	int i;
+
+	for (i = 0; i < phase->nr_patterns; i++) {
+		pattern = &phase->patterns[i];
+		if (!pattern->rate || !pattern->nr_workers)
+			continue;
+		rate = (double)pattern->nr_accesses / runtime_ms;
+		printf("%s:\tpattern %d (%s) %.0f accesses/msec "
+				"(target %.0f), %.2f MiB/s, %.1f%% idle\n",
+				phase->name, i, pattern->mregion->name, rate,
+				pattern->rate, rate * 1000 *
+				access_bytes(pattern) / (1 << 20),
+				100.0 * pattern->idle_cycles /
+				(runtime_ms * cpu_cycle_ms *
+				 pattern->nr_workers));
+	}
+}
+
+/*
+ * Print the time that the work phase took, and the amount of the work done.
+ * The work can be a little bigger than that of the phase, as the workers
+ * stop after their current chunks of the accesses.
+ */
+static void pr_work(struct phase_exec *exec, unsigned long long end)
+{
+	struct phase *phase = exec->phase;
+	unsigned long long elapsed_us;
+
+	elapsed_us = (end - exec->start) * 1000 / exec->cpu_cycle_ms;
+	printf("%s:\t%'llu %s in %'llu usecs", phase->name, exec->work_done,
+			phase->work_in_bytes ? "bytes" : "accesses",
+			elapsed_us);
+	if (exec->work_done < phase->work)
+		printf(" (timed out)");
+	printf("\n");
+}
+
+/*
+ * Write the records in the rings of the workers to record_file, merging those
+ * in the order of the time.  Records newer than the min_ts of any ring are
+ * left for the next call, as the ring could have older records later, unless
+ * @final is set.  The timestamps of the records are converted from the cpu
+ * cycles to the nanoseconds after the start of the recording.
+ */
+static void flush_records(struct phase_exec *exec, int final)
+{
+	double ns_per_cycle = 1000000.0 / exec->cpu_cycle_ms;
+	unsigned long long until = -1ULL, min_ts;
+	struct record_ring *ring, *oldest;
+	struct mtr_record *rec, *oldest_rec = NULL;
+	int i;
+
+	for (i = 0; i < exec->nr_workers; i++) {
+		ring = exec->workers[i].ring;
+		/* read before the head, which the ring has until min_ts */
+		min_ts = __atomic_load_n(&ring->min_ts, __ATOMIC_ACQUIRE);
+		if (min_ts < until)
+			until = min_ts;
+		ring->flush_head = __atomic_load_n(&ring->head,
+				__ATOMIC_ACQUIRE);
+		ring->flush_tail = ring->tail;
+	}
+	if (final)
+		until = -1ULL;
+
+	while (1) {
+		oldest = NULL;
+		for (i = 0; i < exec->nr_workers; i++) {
+			ring = exec->workers[i].ring;
+			if (ring->flush_tail == ring->flush_head)
+				continue;
+			rec = &ring->records[ring->flush_tail %
+				NR_RING_RECORDS];
+			if (rec->ts_ns > until)
+				continue;
+			if (!oldest || rec->ts_ns < oldest_rec->ts_ns) {
+				oldest = ring;
+				oldest_rec = rec;
+			}
+		}
+		if (!oldest)
+			break;
+		oldest_rec->ts_ns = (oldest_rec->ts_ns - record_start) *
+			ns_per_cycle;
+		if (fwrite(oldest_rec, sizeof(*oldest_rec), 1, record_file) !=
+				1)
+			err(1, "writing %s failed", record_path);
+		oldest->flush_tail++;
+	}
+
+	for (i = 0; i < exec->nr_workers; i++) {
+		ring = exec->workers[i].ring;
+		__atomic_store_n(&ring->tail, ring->flush_tail,
+				__ATOMIC_RELEASE);
+	}
+}
+
+/* The flusher thread flushes the rings for every 10 milliseconds */
+static void *run_flusher(void *arg)
+{
+	struct athr_arg *athr_arg = arg;
+	struct phase_exec *exec = athr_arg->thr_arg;
+	struct timespec ts = {.tv_nsec = 10000000};
+
+	while (!ACCESS_ONCE(athr_arg->stop)) {
+		flush_records(exec, 0);
+		nanosleep(&ts, NULL);
+	}
+	return NULL;
+}
+
+/*
+ * Print the number of the sampled accesses, and the overhead of the
+ * recording.  The overhead is the time for the recorded accesses, subtracted
+ * by the time that the accesses would take without the recording, which is
+ * estimated with the average time of other accesses of the pattern.
+ */
+static void pr_recording(struct phase_exec *exec)
+{
+	struct phase *phase = exec->phase;
+	double ns_per_cycle = 1000000.0 / exec->cpu_cycle_ms;
+	unsigned long long nr_records = 0, nr_dropped = 0, busy = 0;
+	double access_cycles, overhead = 0;
+	struct access *pattern;
+	int i, estimated = 0;
+
+	for (i = 0; i < exec->nr_workers; i++)
+		nr_dropped += exec->workers[i].ring->nr_dropped;
+	for (i = 0; i < phase->nr_patterns; i++) {
+		pattern = &phase->patterns[i];
+		nr_records += pattern->nr_recorded;
+		busy += pattern->busy_cycles;
+		if (pattern->nr_accesses <= pattern->nr_recorded)
+			continue;
+		estimated = 1;
+		access_cycles = (double)(pattern->busy_cycles -
+				pattern->record_cycles) /
+			(pattern->nr_accesses - pattern->nr_recorded);
+		if (pattern->record_cycles > access_cycles *
+				pattern->nr_recorded)
+			overhead += pattern->record_cycles -
+				access_cycles * pattern->nr_recorded;
+	}
+	printf("%s:\tsampled %'llu accesses (%'llu dropped)", phase->name,
+			nr_records, nr_dropped);
+	if (estimated && nr_records && busy > overhead)
+		printf(", overhead %.1f ns per record, %.3f%% of the access "
+				"time", overhead / nr_records * ns_per_cycle,
+				overhead * 100 / (busy - overhead));
+	printf("\n");
+}
+
+void exec_phase(struct phase *phase)
+{
+	struct phase_exec exec = {.phase = phase};
+	struct worker *worker;
+	unsigned long long nr_access, runtime_ms, end;
+	static unsigned long long cpu_cycle_ms, clock_overhead;
+	static unsigned phase_seq;
+	int i, ret;
+
+	exec.seq = phase_seq++;
+
+	if (!cpu_cycle_ms) {
+		cpu_cycle_ms = aclk_freq() / 1000;
+		clock_overhead = aclk_overhead();
+	}
+	exec.cpu_cycle_ms = cpu_cycle_ms;
+	exec.clock_overhead = clock_overhead;
+
+	setup_workers(&exec);
+
+	if (perf_enabled) {
+		aperf_read(&perf, exec.perf_start);
+		memcpy(exec.perf_last, exec.perf_start,
+				sizeof(exec.perf_start));
+	}
+	exec.start = aclk_clock();
+
+	if (hintmethod != NONE)
+		hint_access_pattern(phase);
+
+	if (record_file) {
+		exec.flusher.cpu = -1;
+		exec.flusher.arg.thr_arg = &exec;
+		ret = athr_start(&exec.flusher, run_flusher);
+		if (ret)
+			errx(1, "failed starting flusher: %s", strerror(ret));
+	}
+
+	worker = &exec.workers[0];
+	if (exec.nr_workers == 1 && worker->thr.cpu < 0) {
+		run_worker(&worker->thr.arg);
+	} else {
+		for (i = 0; i < exec.nr_workers; i++) {
+			worker = &exec.workers[i];
+			ret = athr_start(&worker->thr, run_worker);
+			if (ret)
+				errx(1, "failed starting worker %d: %s", i,
+						strerror(ret));
+		}
+		for (i = 0; i < exec.nr_workers; i++)
+			athr_join(&exec.workers[i].thr);
+	}
+
+	end = aclk_clock();
+	if (record_file) {
+		athr_stop(&exec.flusher);
+		athr_join(&exec.flusher);
+		flush_records(&exec, 1);
+	}
+	if (perf_enabled)
+		aperf_read(&perf, exec.perf_last);
+	nr_access = nr_workers_accesses(&exec);
+	runtime_ms = (end - exec.start) / cpu_cycle_ms;
+	if (!runtime_ms)
+		runtime_ms = 1;
+	if (!quiet && !log_interval_ms) {
+		printf("%s:\t%'20llu accesses/msec, %llu msecs run",
+				phase->name, nr_access / runtime_ms,
+				runtime_ms);
+		if (exec.nr_workers > 1)
+			printf(", %d threads", exec.nr_workers);
+		printf("\n");
+	}
+	if (!quiet && phase->work)
+		pr_work(&exec, end);
+	if (!quiet && perf_enabled)
+		pr_perf(phase->name, exec.perf_start, exec.perf_last, nr_access);
+
+	sum_workers_stats(&exec);
+	if (stats_file)
+		pr_stats(&exec, "phase", end);
+	if (!quiet) {
+		pr_chase_latency(phase, cpu_cycle_ms);
+		pr_shuffle_passes(phase);
+		pr_rates(phase, runtime_ms, cpu_cycle_ms);
+		pr_latency(&exec);
+		if (record_file)
+			pr_recording(&exec);
+	}
+	cleanup_workers(&exec);
+}
+
+/*
+ * Build a random cyclic chain of @region->chase_stride size units of the
+ * region.  Each unit has the link to the next unit, i.e., offset of the link
+ * of the next unit, at its end.
+ *
+ * The chain is made with Sattolo's algorithm[1] in place, so that no memory
+ * proportional to the size of the region is needed.  Starting from the units
+ * linking themselves, swapping the link of each unit with the link of a
+ * random preceding unit makes single cycle that covers every unit.
+ *
+ * [1] https://danluu.com/sattolo/
+ */
+static void build_chase_chain(struct mregion *region)
+{
+	size_t stride = region->chase_stride;
+	size_t nr_units = region->sz / stride;
+	char *rr = region->region + chase_link_offset(stride);
+	size_t i, j, tmp;
+
+	for (i = 0; i < nr_units; i++)
+		*(size_t *)&rr[i * stride] =
+			i * stride + chase_link_offset(stride);
+	for (i = nr_units - 1; i > 0; i--) {
+		j = rndint(i);
+		tmp = *(size_t *)&rr[i * stride];
+		*(size_t *)&rr[i * stride] = *(size_t *)&rr[j * stride];
+		*(size_t *)&rr[j * stride] = tmp;
+	}
+}
+
+/*
+ * Apply the NUMA memory policy of @region with the raw system call, so that
+ * libnuma is not needed.  The region should be mapped but not faulted in.
+ */
+static void set_region_numa(struct mregion *region)
+{
+	if (syscall(__NR_mbind, region->region, region->sz,
+				region->numa_mode, region->nodemask,
+				MAX_NUMA_NODES + 1, 0))
+		err(1, "mbind for region %s", region->name);
+}
+
+/*
+ * Print the number of the pages of @region on each NUMA node.  The nodes are
+ * queried with move_pages() without the target nodes, which doesn't move the
+ * pages.
+ */
+#define NR_QUERY_PAGES	1024
+
+static void pr_numa_residency(struct mregion *region)
+{
+	void *pages[NR_QUERY_PAGES];
+	int status[NR_QUERY_PAGES];
+	unsigned long nr_node_pages[MAX_NUMA_NODES] = {};
+	unsigned long nr_absent = 0;
+	size_t nr_pages = (region->sz + SZ_PAGE - 1) / SZ_PAGE;
+	size_t i, nr;
+	int j;
+
+	for (i = 0; i < nr_pages; i += nr) {
+		nr = nr_pages - i < NR_QUERY_PAGES ? nr_pages - i :
+			NR_QUERY_PAGES;
+		for (j = 0; j < nr; j++)
+			pages[j] = region->region + (i + j) * SZ_PAGE;
+		if (syscall(__NR_move_pages, 0, nr, pages, NULL, status, 0)) {
+			warn("move_pages for region %s", region->name);
+			return;
+		}
+		for (j = 0; j < nr; j++) {
+			if (status[j] >= 0 && status[j] < MAX_NUMA_NODES)
+				nr_node_pages[status[j]]++;
+			else
+				nr_absent++;
+		}
+	}
+	printf("region %s:", region->name);
+	for (j = 0; j < MAX_NUMA_NODES; j++) {
+		if (nr_node_pages[j])
+			printf(" node%d %lu pages,", j, nr_node_pages[j]);
+	}
+	printf(" %lu pages not present\n", nr_absent);
+}
+
+/* Returns the default hugetlb page size, from /proc/meminfo */
+static size_t default_hugepage_sz(void)
+{
+	static size_t sz;
+	char line[128];
+	FILE *f;
+
+	if (sz)
+		return sz;
+	sz = SZ_2M;
+	f = fopen("/proc/meminfo", "r");
+	if (!f)
+		return sz;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "Hugepagesize: %zu kB", &sz) == 1) {
+			sz *= 1024;
+			break;
+		}
+	}
+	fclose(f);
+	return sz;
+}
+
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT	21
+#endif
+
+static int region_is_file(struct mregion *region)
+{
+	return region->backing == BACKING_FILE ||
+		region->backing == BACKING_FILE_PRIVATE;
+}
+
+/*
+ * Returns a file descriptor for the memory of @region, after sizing it to
+ * cover the whole region.  Returns -1 for the anonymous regions.
+ */
+static int open_region_backing(struct mregion *region)
+{
+	char shm_name[64];
+	struct stat st;
+	int fd;
+
+	/* existing files are not modified for the private mappings */
+	if (region->backing == BACKING_FILE_PRIVATE) {
+		fd = open(region->backing_file, O_RDONLY);
+		if (fd == -1 && errno != ENOENT)
+			err(1, "open %s for region %s", region->backing_file,
+					region->name);
+		if (fd != -1) {
+			if (fstat(fd, &st))
+				err(1, "fstat for region %s", region->name);
+			if (st.st_size < region->sz)
+				errx(1, "%s is smaller than region %s",
+						region->backing_file,
+						region->name);
+			return fd;
+		}
+	}
+
+	switch (region->backing) {
+	case BACKING_FILE:
+	case BACKING_FILE_PRIVATE:
+		fd = open(region->backing_file, O_RDWR | O_CREAT, 0644);
+		if (fd == -1)
+			err(1, "open %s for region %s", region->backing_file,
+					region->name);
+		break;
+	case BACKING_MEMFD:
+		fd = syscall(__NR_memfd_create, region->name, 0);
+		if (fd == -1)
+			err(1, "memfd_create for region %s", region->name);
+		break;
+	case BACKING_SHM:
+		snprintf(shm_name, sizeof(shm_name), "/masim-%d-%.32s",
+				getpid(), region->name);
+		fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd == -1)
+			err(1, "shm_open for region %s", region->name);
+		/* the mapping keeps the memory */
+		shm_unlink(shm_name);
+		break;
+	default:
+		return -1;
+	}
+
+	if (fstat(fd, &st))
+		err(1, "fstat for region %s", region->name);
+	if (st.st_size < region->sz && ftruncate(fd, region->sz))
+		err(1, "ftruncate for region %s", region->name);
+	return fd;
+}
+
+/*
+ * Attach a SysV shared memory segment for @region at @addr.  The segment is
+ * marked to be destroyed on the last detach.
+ */
+static char *attach_sysv_region(struct mregion *region, char *addr)
+{
+	int shmid;
+	char *shm;
+
+	shmid = shmget(IPC_PRIVATE, region->sz, IPC_CREAT | 0600);
+	if (shmid == -1)
+		err(1, "shmget for region %s", region->name);
+	shm = shmat(shmid, addr, addr ? SHM_REMAP : 0);
+	if (shm == (void *)-1)
+		err(1, "shmat for region %s", region->name);
+	shmctl(shmid, IPC_RMID, NULL);
+	return shm;
+}
+
+/*
+ * Returns if populate=map of @region can be done with MAP_POPULATE.  The pages
+ * should be faulted after the NUMA policy and the THP hint are applied, so
+ * those regions are prefaulted instead.
+ */
+static int map_populates(struct mregion *region)
+{
+	return region->populate == POPULATE_MAP &&
+		region->numa_mode == MPOL_DEFAULT &&
+		region->pages != PAGES_THP && region->pages != PAGES_NOTHP;
+}
+
+/*
+ * Map @region following its backing and page policy.  The mapping is rounded
+ * up to the page size.  THP regions are placed at 2 MiB-aligned address in a
+ * reserved range, so that the whole region can be backed by huge pages.  The
+ * real mapping is kept in @region->map_addr and @region->map_sz for the
+ * unmapping.
+ */
+static void map_region(struct mregion *region)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	size_t align = SZ_PAGE;
+	char *addr = NULL;
+	int fd;
+
+	switch (region->pages) {
+	case PAGES_THP:
+		align = SZ_2M;
+		break;
+	case PAGES_HUGETLB:
+		flags |= MAP_HUGETLB;
+		align = default_hugepage_sz();
+		break;
+	case PAGES_2M:
+		flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+		align = SZ_2M;
+		break;
+	case PAGES_1G:
+		flags |= MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+		align = SZ_1G;
+		break;
+	default:
+		break;
+	}
+	if (map_populates(region))
+		flags |= MAP_POPULATE;
+	if (region->backing != BACKING_ANON && (flags & MAP_HUGETLB))
+		errx(1, "region %s: %s backing cannot use hugetlb pages",
+				region->name,
+				region_backing_str[region->backing]);
+	region->map_sz = (region->sz + align - 1) / align * align;
+
+	if (region->pages == PAGES_THP) {
+		/* reserve a range having room for the alignment */
+		region->map_addr = mmap(NULL, region->map_sz + align,
+				PROT_NONE, flags | MAP_NORESERVE, -1, 0);
+		if (region->map_addr == MAP_FAILED)
+			err(1, "mmap for region %s reservation",
+					region->name);
+		region->map_sz += align;
+		addr = (char *)(((uintptr_t)region->map_addr + align - 1) &
+				~(align - 1));
+		flags |= MAP_FIXED;
+	}
+
+	fd = open_region_backing(region);
+	if (region->backing == BACKING_SYSV) {
+		addr = attach_sysv_region(region, addr);
+	} else {
+		if (fd != -1) {
+			flags &= ~(MAP_PRIVATE | MAP_ANONYMOUS);
+			flags |= region->backing == BACKING_FILE_PRIVATE ?
+				MAP_PRIVATE : MAP_SHARED;
+		}
+		addr = mmap(addr, region->pages == PAGES_THP ?
+				region->sz : region->map_sz,
+				PROT_READ | PROT_WRITE, flags, fd, 0);
+		if (addr == MAP_FAILED)
+			err(1, "mmap for region %s with %s pages",
+					region->name,
+					page_policy_str[region->pages]);
+	}
+	if (fd != -1)
+		close(fd);
+	if (region->pages != PAGES_THP)
+		region->map_addr = addr;
+	region->region = addr;
+
+	if (region->pages == PAGES_THP) {
+		if (madvise(region->region, region->sz, MADV_HUGEPAGE))
+			err(1, "MADV_HUGEPAGE for region %s", region->name);
+	} else if (region->pages == PAGES_NOTHP) {
+		if (madvise(region->region, region->sz, MADV_NOHUGEPAGE))
+			err(1, "MADV_NOHUGEPAGE for region %s", region->name);
+	}
+}
+
+static void unmap_region(struct mregion *region)
+{
+	if (region->backing == BACKING_SYSV)
+		shmdt(region->region);
+	munmap(region->map_addr, region->map_sz);
+}
+
+/* a slice of a region that an init thread initializes */
+struct init_slice {
+	struct athr thr;
+	struct mregion *region;
+	size_t start;
+	size_t end;
+	int prefault;
+	int fd;		/* the data file to read, or -1 */
+	int seekable;	/* if @fd is a regular file */
+	char *src;	/* the mapped data file to copy, or NULL */
+	size_t data_sz;	/* size of the data to load */
+};
+
+/* size of each read() of the initial data */
+#define SZ_INIT_READ	(1UL << 20)
+
+static void *init_region_slice(void *arg)
+{
+	struct athr_arg *athr_arg = arg;
+	struct init_slice *slice = athr_arg->thr_arg;
+	struct mregion *region = slice->region;
+	volatile char *p = region->region;
+	size_t end = slice->end, i, len;
+	ssize_t ret;
+
+	if (slice->prefault) {
+		/* read the pages of the files, so that those are not dirtied */
+		for (i = slice->start; i < end; i += SZ_PAGE) {
+			if (region_is_file(region))
+				(void)p[i];
+			else
+				p[i] = p[i];
+		}
+	}
+
+	if (end > slice->data_sz)
+		end = slice->data_sz;
+	if (slice->src) {
+		if (slice->start < end)
+			memcpy(&region->region[slice->start],
+					&slice->src[slice->start],
+					end - slice->start);
+		return NULL;
+	}
+	if (slice->fd == -1)
+		return NULL;
+	for (i = slice->start; i < end; i += ret) {
+		len = end - i < SZ_INIT_READ ? end - i : SZ_INIT_READ;
+		if (slice->seekable)
+			ret = pread(slice->fd, &region->region[i], len, i);
+		else
+			ret = read(slice->fd, &region->region[i], len);
+		if (ret == -1)
+			err(1, "init data load of region %s", region->name);
+		if (!ret)
+			break;
+	}
+	return NULL;
+}
+
+/*
+ * Prefault the pages of @region and load the initial data file to it, with
+ * --init_threads threads.  Each thread handles a page-aligned slice of the
+ * region.  Data of regular files is read directly into the region with
+ * pread(), or copied from the mapped file.  Other files like pipes are read by
+ * only one thread.  Only the size of the file is loaded if the file is smaller
+ * than the region.
+ */
+static void init_region_data(struct mregion *region)
+{
+	struct init_slice *slices, *slice;
+	int fd = -1, seekable = 0;
+	char *src = NULL;
+	size_t data_sz = 0;
+	struct stat st;
+	int nr_threads = nr_init_threads, i, ret;
+	int prefault = region->populate == POPULATE_PREFAULT ||
+		(region->populate == POPULATE_MAP && !map_populates(region));
+
+	if (!prefault && !region->data_file)
+		return;
+
+	if (region->data_file) {
+		fd = open(region->data_file, O_RDONLY);
+		if (fd == -1)
+			err(1, "init data load, open %s", region->data_file);
+		if (fstat(fd, &st))
+			err(1, "init data load, fstat %s", region->data_file);
+		seekable = S_ISREG(st.st_mode);
+		data_sz = region->sz;
+		if (seekable && st.st_size < data_sz)
+			data_sz = st.st_size;
+		if (seekable && data_sz && region->load == LOAD_COPY) {
+			src = mmap(NULL, data_sz, PROT_READ, MAP_PRIVATE, fd,
+					0);
+			if (src == MAP_FAILED)
+				err(1, "init data load, mmap %s",
+						region->data_file);
+		}
+	}
+
+	if (nr_threads > region->sz / SZ_PAGE)
+		nr_threads = region->sz / SZ_PAGE ? region->sz / SZ_PAGE : 1;
+	/* streams should be read in order */
+	if (fd != -1 && !seekable)
+		nr_threads = 1;
+	slices = calloc(nr_threads, sizeof(*slices));
+	if (!slices)
+		err(1, "init slices alloc");
+	for (i = 0; i < nr_threads; i++) {
+		slice = &slices[i];
+		slice->thr.cpu = -1;
+		slice->thr.arg.thr_arg = slice;
+		slice->region = region;
+		slice->start = region->sz / nr_threads * i / SZ_PAGE * SZ_PAGE;
+		slice->end = i == nr_threads - 1 ? region->sz :
+			region->sz / nr_threads * (i + 1) / SZ_PAGE * SZ_PAGE;
+		slice->prefault = prefault;
+		slice->fd = fd;
+		slice->seekable = seekable;
+		slice->src = src;
+		slice->data_sz = data_sz;
+	}
+
+	if (nr_threads == 1) {
+		init_region_slice(&slices[0].thr.arg);
+	} else {
+		for (i = 0; i < nr_threads; i++) {
+			ret = athr_start(&slices[i].thr, init_region_slice);
+			if (ret)
+				errx(1, "failed starting init thread %d: %s",
+						i, strerror(ret));
+		}
+		for (i = 0; i < nr_threads; i++)
+			athr_join(&slices[i].thr);
+	}
+
+	free(slices);
+	if (src)
+		munmap(src, data_sz);
+	if (fd != -1)
+		close(fd);
+}
+
+/*
+ * Reclaim the pages of @region before the phases start.  The dirty pages of
+ * the shared files are written back before the reclaim, and the page cache
+ * of the files are also dropped.
+ */
+static void drop_region(struct mregion *region)
+{
+	int fd;
+
+	if (region->backing == BACKING_FILE &&
+			msync(region->region, region->sz, MS_SYNC))
+		err(1, "msync for region %s", region->name);
+	if (madvise(region->region, region->sz, MADV_PAGEOUT))
+		warn("MADV_PAGEOUT for region %s", region->name);
+	if (!region_is_file(region))
+		return;
+	fd = open(region->backing_file, O_RDONLY);
+	if (fd == -1 || posix_fadvise(fd, 0, region->sz,
+				POSIX_FADV_DONTNEED))
+		warn("dropping page cache of %s", region->backing_file);
+	if (fd != -1)
+		close(fd);
+}
+
+static void init_region(struct mregion *region)
+{
+	/* NUMA policy should be applied to a fresh mapping */
+	if (region->pages == PAGES_DEFAULT &&
+			(region->numa_mode != MPOL_DEFAULT ||
+			 region->backing != BACKING_ANON ||
+			 region->populate == POPULATE_MAP))
+		region->pages = PAGES_4K;
+
+	if (region->pages != PAGES_DEFAULT) {
+		map_region(region);
+		if (region->numa_mode != MPOL_DEFAULT)
+			set_region_numa(region);
+	} else {
+		/* align for the wide accesses and the madvise() hint */
+		if (posix_memalign((void **)&region->region, SZ_PAGE,
+					region->sz))
+			err(1, "region alloc");
+		region->map_sz = 0;
+	}
+	init_region_data(region);
+	if (region->chase_stride)
+		build_chase_chain(region);
+	if (region->populate == POPULATE_DROP)
+		drop_region(region);
+}
+
+static void init_regions(struct access_config *config)
+{
+	struct timespec start, end;
+	size_t i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < config->nr_regions; i++)
+		init_region(&config->regions[i]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (!quiet)
+		printf("regions setup:\t%llu msecs\n",
+				((end.tv_sec - start.tv_sec) * 1000000000ULL +
+				 end.tv_nsec - start.tv_nsec) / 1000000);
+	config->regions_ready = 1;
+}
+
+static void release_regions(struct access_config *config)
+{
+	struct mregion *region;
+	size_t i;
+
+	for (i = 0; i < config->nr_regions; i++) {
+		region = &config->regions[i];
+		if (region->numa_mode != MPOL_DEFAULT && !quiet)
+			pr_numa_residency(region);
+		if (region->map_sz)
+			unmap_region(region);
+		else
+			free(region->region);
+		region->region = NULL;
+	}
+	config->regions_ready = 0;
+}
+
+/*
+ * Open record_file and write the header.  The records refer to the regions
+ * of @config with their indices.
+ */
+static void open_recorder(struct access_config *config)
+{
+	struct mtr_header h = {};
+
+	record_file = fopen(record_path, "w");
+	if (!record_file)
+		err(1, "open(\"%s\") failed", record_path);
+	memcpy(h.magic, MTR_MAGIC, sizeof(h.magic));
+	h.version = MTR_VERSION;
+	h.byte_order = MSB_BYTE_ORDER;
+	h.flags = MTR_TIMESTAMPS;
+	if (fwrite(&h, sizeof(h), 1, record_file) != 1)
+		err(1, "writing %s failed", record_path);
+	record_regions = config->regions;
+	record_start = aclk_clock();
+}
+
+static void close_recorder(void)
+{
+	if (fclose(record_file))
+		err(1, "writing %s failed", record_path);
+	record_file = NULL;
+}
+
+/*
+ * Execute the phases of @config.  The regions are initialized if those are
+ * not, and released at the end unless --keep_regions is given.
+ */
+void exec_config(struct access_config *config)
+{
+	size_t i;
+
+	arnd_seed(&rnd, rnd_seed);
+	if (!config->regions_ready)
+		init_regions(config);
+
+	for (i = 0; i < config->nr_phases; i++)
+		exec_phase(&config->phases[i]);
+
+	if (!keep_regions)
+		release_regions(config);
+}
+
+/* Returns @str without leading and trailing spaces.  @str is modified. */
+static char *strip_spaces(char *str)
+{
+	char *end;
+
+	while (*str == ' ' || *str == '\t')
+		str++;
+	end = str + strlen(str);
+	while (end > str && (end[-1] == ' ' || end[-1] == '\t'))
+		*--end = '\0';
+	return str;
+}
+
+/*
+ * Reader of the config file, which is mapped to the memory and tokenized in a
+ * single pass.  Each line is copied to a buffer that reused for all lines, and
+ * split into the fields in place.
+ */
+struct cfg_reader {
+	char *buf;		/* the mapped file */
+	size_t len;
+	size_t pos;
+	char *line;		/* the current line */
+	size_t line_sz;
+	char **fields;		/* fields of the current line */
+	int max_fields;
+	struct access *patterns;	/* patterns of the current phase */
+	int max_patterns;
+	struct aarena *arena;	/* arena for the parsed config */
+};
+
+/*
+ * Returns the next line of @r that is not a comment, or NULL at the end of the
+ * file.  Empty lines are returned as empty strings, as those separate the
+ * paragraphs.  The returned line is valid until the next call.
+ */
+static char *cfg_next_line(struct cfg_reader *r)
+{
+	char *start, *eol;
+	size_t len;
+
+	while (r->pos < r->len) {
+		start = r->buf + r->pos;
+		eol = memchr(start, '\n', r->len - r->pos);
+		len = eol ? eol - start : r->len - r->pos;
+		r->pos += len + 1;
+		if (len && start[0] == '#')
+			continue;
+		if (len + 1 > r->line_sz) {
+			r->line_sz = len + 1 > r->line_sz * 2 ?
+				len + 1 : r->line_sz * 2;
+			r->line = realloc(r->line, r->line_sz);
+			if (!r->line)
+				err(1, "config line alloc");
+		}
+		memcpy(r->line, start, len);
+		r->line[len] = '\0';
+		return r->line;
+	}
+	return NULL;
+}
+
+/* Returns the first line of the next paragraph, or NULL if no more */
+static char *cfg_next_paragraph(struct cfg_reader *r)
+{
+	char *line;
+
+	while ((line = cfg_next_line(r)) && !*line)
+		;
+	return line;
+}
+
+/*
+ * Split @str with @delim in place.  The fields are stored in @r->fields.
+ * Returns the number of the fields.
+ */
+static int cfg_split(struct cfg_reader *r, char *str, char delim)
+{
+	int nr_fields = 0;
+
+	while (1) {
+		if (nr_fields == r->max_fields) {
+			r->max_fields = r->max_fields ? r->max_fields * 2 : 16;
+			r->fields = realloc(r->fields,
+					sizeof(*r->fields) * r->max_fields);
+			if (!r->fields)
+				err(1, "config fields alloc");
+		}
+		r->fields[nr_fields++] = str;
+		str = strchr(str, delim);
+		if (!str)
+			break;
+		*str++ = '\0';
+	}
+	return nr_fields;
+}
+
+static void parse_region_opts(char **fields, int nr_fields,
+		struct mregion *r, struct aarena *arena);
+
+/* Parse the regions paragraph, which is the first paragraph of @reader */
+static void parse_regions(struct cfg_reader *reader,
+		struct access_config *config)
+{
+	struct mregion *r;
+	size_t max_regions = 0;
+	char *line, **fields, *data_file;
+	int nr_fields, k;
+
+	config->regions = NULL;
+	config->nr_regions = 0;
+	line = cfg_next_paragraph(reader);
+	if (!line)
+		errx(1, "Not enough lines");
+	for (; line && *line; line = cfg_next_line(reader)) {
+		if (config->nr_regions == max_regions) {
+			max_regions = max_regions ? max_regions * 2 : 16;
+			config->regions = realloc(config->regions,
+					sizeof(*config->regions) * max_regions);
+			if (!config->regions)
+				err(1, "regions alloc");
+		}
+		r = &config->regions[config->nr_regions++];
+		nr_fields = cfg_split(reader, line, ',');
+		fields = reader->fields;
+		if (nr_fields < 2)
+			errx(1, "Wrong format config file: %s", line);
+		if (strlen(fields[0]) >= sizeof(r->name))
+			errx(1, "too long region name: %s", fields[0]);
+		strcpy(r->name, fields[0]);
+		r->sz = atoll(fields[1]);
+		r->region = NULL;
+		r->chase_stride = 0;
+		r->data_file = NULL;
+		r->numa_mode = MPOL_DEFAULT;
+		memset(r->nodemask, 0, sizeof(r->nodemask));
+		r->pages = use_hugetlb ? PAGES_HUGETLB : PAGES_DEFAULT;
+		r->map_addr = NULL;
+		r->map_sz = 0;
+		r->backing = BACKING_ANON;
+		r->backing_file = NULL;
+		r->populate = POPULATE_NONE;
+		r->load = LOAD_READ;
+		k = 2;
+		if (nr_fields > 2 && !strchr(fields[2], '=')) {
+			k++;
+			data_file = strip_spaces(fields[2]);
+			if (strcmp("none", data_file)) {
+				r->data_file = aarena_strdup(reader->arena,
+						data_file);
+				if (!r->data_file)
+					err(1, "data_file alloc");
+			}
+		}
+		parse_region_opts(&fields[k], nr_fields - k, r, reader->arena);
+	}
+}
+
+/**
+ * parse_opt - Parse an option field of "<key>=<value>" format
+ *
+ * @field	The field.  It is modified.
+ * @key_ptr	Pointer to store the key.
+ *
+ * Returns the value if @field is an option, NULL else.
+ */
+static char *parse_opt(char *field, char **key_ptr)
+{
+	char *eq;
+
+	eq = strchr(field, '=');
+	if (!eq)
+		return NULL;
+	*eq = '\0';
+	*key_ptr = strip_spaces(field);
+	return strip_spaces(eq + 1);
+}
+
+/**
+ * parse_id_list - Parse a list of cpu or node ids
+ *
+ * @str		The list.  Ids or ranges of ids separated by ';', e.g.,
+ *		"0-3;8;10-11".
+ * @ids_ptr	Pointer to store the array of the ids.
+ * @what	What the ids are for, e.g., "cpu".
+ *
+ * Returns the number of ids in the list.
+ */
+static int parse_id_list(char *str, int **ids_ptr, const char *what)
+{
+	char **ranges;
+	int nr_ranges;
+	int *ids = NULL;
+	int nr_ids = 0;
+	int from, to;
+	int i;
+
+	nr_ranges = astr_split(str, ';', &ranges);
+	for (i = 0; i < nr_ranges; i++) {
+		switch (sscanf(ranges[i], "%d-%d", &from, &to)) {
+		case 1:
+			to = from;
+			break;
+		case 2:
+			break;
+		default:
+			errx(1, "wrong %s list: %s", what, str);
+		}
+		if (from < 0 || to < from)
+			errx(1, "wrong %s range: %s", what, ranges[i]);
+		ids = realloc(ids, sizeof(*ids) * (nr_ids + to - from + 1));
+		if (!ids)
+			err(1, "%s ids alloc", what);
+		for (; from <= to; from++)
+			ids[nr_ids++] = from;
+	}
+	astr_free_str_array(ranges, nr_ranges);
+
+	*ids_ptr = ids;
+	return nr_ids;
+}
+
+/*
+ * Parse "numa=<mode>:<nodes>" option of a region, e.g., "numa=bind:0" or
+ * "numa=interleave:0-1;3".
+ */
+static void parse_numa_opt(char *val, struct mregion *r)
+{
+	char *nodes;
+	int *ids;
+	int nr_ids, i;
+
+	nodes = strchr(val, ':');
+	if (!nodes)
+		errx(1, "numa option needs nodes: %s", val);
+	*nodes++ = '\0';
+	for (i = 0; i < LEN_ARRAY(numa_mode_str); i++) {
+		if (numa_mode_str[i] && !strcmp(val, numa_mode_str[i]))
+			break;
+	}
+	if (i == LEN_ARRAY(numa_mode_str) || i == MPOL_DEFAULT)
+		errx(1, "unknown numa mode: %s", val);
+	r->numa_mode = i;
+	nr_ids = parse_id_list(nodes, &ids, "node");
+	for (i = 0; i < nr_ids; i++) {
+		if (ids[i] >= MAX_NUMA_NODES)
+			errx(1, "node %d is out of the range", ids[i]);
+		r->nodemask[ids[i] / LONG_BITS] |= 1UL << (ids[i] % LONG_BITS);
+	}
+	free(ids);
+}
+
+/* Returns the index of @val in @strs, which has @nr strings */
+static int str_idx(char *val, const char * const *strs, int nr,
+		const char *what)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (strs[i] && !strcmp(val, strs[i]))
+			return i;
+	}
+	errx(1, "unknown %s: %s", what, val);
+}
+
+/*
+ * Parse "backing=<type>[:<file>]" option of a region, e.g., "backing=memfd" or
+ * "backing=file:/mnt/pmem/a".
+ */
+static void parse_backing_opt(char *val, struct mregion *r,
+		struct aarena *arena)
+{
+	char *file;
+
+	file = strchr(val, ':');
+	if (file)
+		*file++ = '\0';
+	r->backing = str_idx(val, region_backing_str,
+			LEN_ARRAY(region_backing_str), "region backing");
+	if (!region_is_file(r)) {
+		if (file)
+			errx(1, "%s backing doesn't take a file", val);
+		return;
+	}
+	if (!file || !*file)
+		errx(1, "%s backing needs a file", val);
+	r->backing_file = aarena_strdup(arena, file);
+	if (!r->backing_file)
+		err(1, "backing_file alloc");
+}
+
+/*
+ * Make the initial data file of @r the private file backing of the region, for
+ * "load=map" option.
+ */
+static void set_data_file_backing(struct mregion *r)
+{
+	if (!r->data_file)
+		errx(1, "region %s: load=map needs the data file", r->name);
+	if (r->backing != BACKING_ANON)
+		errx(1, "region %s: load=map cannot be used with backing",
+				r->name);
+	r->backing = BACKING_FILE_PRIVATE;
+	r->backing_file = r->data_file;
+	r->data_file = NULL;
+}
+
+/*
+ * Parse the option fields of a region line, e.g., "numa=bind:1",
+ * "pages=thp", or "backing=file:/tmp/a".
+ */
+static void parse_region_opts(char **fields, int nr_fields,
+		struct mregion *r, struct aarena *arena)
+{
+	char *key, *val;
+	int i;
+
+	for (i = 0; i < nr_fields; i++) {
+		val = parse_opt(fields[i], &key);
+		if (!val)
+			errx(1, "wrong region option: %s", fields[i]);
+		if (!strcmp(key, "numa"))
+			parse_numa_opt(val, r);
+		else if (!strcmp(key, "pages"))
+			r->pages = str_idx(val, page_policy_str,
+					LEN_ARRAY(page_policy_str),
+					"page policy");
+		else if (!strcmp(key, "backing"))
+			parse_backing_opt(val, r, arena);
+		else if (!strcmp(key, "load"))
+			r->load = str_idx(val, region_load_str,
+					LEN_ARRAY(region_load_str),
+					"load method");
+		else if (!strcmp(key, "populate"))
+			r->populate = str_idx(val, region_populate_str,
+					LEN_ARRAY(region_populate_str),
+					"populate mode");
+		else
+			errx(1, "unknown region option: %s", key);
+	}
+	if (r->load == LOAD_MAP)
+		set_data_file_backing(r);
+}
+
+/*
+ * Parse the threads related options, which can be given for both phases and
+ * access patterns.  Returns non-zero if @key is not for the threads.
+ */
+static int parse_threads_opt(char *key, char *val, int *nr_threads,
+		int **cpus, int *nr_cpus)
+{
+	if (!strcmp(key, "threads")) {
+		*nr_threads = atoi(val);
+		if (*nr_threads < 0)
+			errx(1, "wrong number of threads: %s", val);
+	} else if (!strcmp(key, "cpus")) {
+		*nr_cpus = parse_id_list(val, cpus, "cpu");
+	} else {
+		return 1;
+	}
+	return 0;
+}
+
+/* The width can be 1, 8, 16, 32, 64, or "cl" for a whole cache line */
+static void parse_width_opt(char *val, struct access *a)
+{
+	if (!strcmp(val, "cl"))
+		a->width = SZ_CACHELINE;
+	else
+		a->width = atoi(val);
+}
+
+static const char * const access_dist_str[] = {
+	[UNIFORM] = "uniform",
+	[ZIPF] = "zipf",
+	[HOTSET] = "hot",
+	[GAUSSIAN] = "gauss",
+};
+
+/* minimum and maximum numbers of arguments for each distribution */
+static const int access_dist_nr_args[][2] = {
+	[UNIFORM] = {0, 0},
+	[ZIPF] = {1, 1},
+	[HOTSET] = {2, 2},
+	[GAUSSIAN] = {1, 2},
+};
+
+/*
+ * Parse "dist=<name>[:<arg>]..." option, e.g., "dist=zipf:0.99",
+ * "dist=hot:90:10", or "dist=gauss:5:0.1".  The last argument of gauss is
+ * optional.
+ */
+static void parse_dist_opt(char *val, struct access *a)
+{
+	char **args;
+	int nr_args;
+	int i;
+
+	nr_args = astr_split(val, ':', &args) - 1;
+	for (i = 0; i < NR_ACCESS_DISTS; i++) {
+		if (!strcmp(args[0], access_dist_str[i]))
+			break;
+	}
+	if (i == NR_ACCESS_DISTS)
+		errx(1, "unknown distribution: %s", args[0]);
+	a->dist = i;
+	if (nr_args < access_dist_nr_args[a->dist][0] ||
+			nr_args > access_dist_nr_args[a->dist][1])
+		errx(1, "wrong number of arguments for %s", val);
+	a->dist_args[1] = 0;
+	for (i = 0; i < nr_args; i++)
+		a->dist_args[i] = atof(args[i + 1]);
+	astr_free_str_array(args, nr_args + 1);
+}
+
+/*
+ * Set up the distribution of the random accesses.  Called after all options
+ * of the pattern are parsed and the stride is set, since it depends on those.
+ */
+static void setup_dist(struct access *a)
+{
+	size_t nr_units;
+	double *args = a->dist_args;
+
+	if (a->dist == UNIFORM)
+		return;
+	nr_units = a->mregion->sz / a->stride;
+	switch (a->dist) {
+	case ZIPF:
+		if (args[0] < 0)
+			errx(1, "zipf theta should not be negative");
+		avgn_zipf_init(&a->zipf, nr_units, args[0]);
+		break;
+	case HOTSET:
+		if (args[0] < 0 || args[0] > 100 || args[1] <= 0 ||
+				args[1] >= 100)
+			errx(1, "wrong hot set: %.2f%% accesses to %.2f%%",
+					args[0], args[1]);
+		a->hot_units = nr_units * args[1] / 100;
+		if (!a->hot_units || a->hot_units == nr_units)
+			errx(1, "region %s is too small for the hot set",
+					a->mregion->name);
+		a->hot_threshold = args[0] >= 100 ? UINT64_MAX :
+			(uint64_t)(args[0] / 100 * 0x1.0p64);
+		break;
+	case GAUSSIAN:
+		if (args[0] <= 0)
+			errx(1, "gaussian stddev should be positive");
+		a->gauss_sigma = nr_units * args[0] / 100;
+		a->gauss_speed = args[1] / 100;
+		a->gauss_center = nr_units / 2;
+		break;
+	default:
+		break;
+	}
+}
+
+static void parse_offset_opt(char *val, struct access *a)
+{
+	a->unit_offset = strtoull(val, NULL, 0);
+}
+
+/*
+ * Parse "rate=<bytes>[K|M|G]" option for the target bytes per second, or
+ * "rate=<number>/ms" for the target accesses per millisecond.
+ */
+static void parse_rate_opt(char *val, struct access *a)
+{
+	char *end;
+	double rate;
+
+	rate = strtod(val, &end);
+	if (rate <= 0)
+		errx(1, "wrong rate: %s", val);
+	if (!strcmp(end, "/ms")) {
+		a->rate = rate;
+		a->rate_bytes = 0;
+		return;
+	}
+	switch (*end) {
+	case 'G':
+		rate *= 1024;
+		/* fall through */
+	case 'M':
+		rate *= 1024;
+		/* fall through */
+	case 'K':
+		rate *= 1024;
+		end++;
+		break;
+	}
+	if (*end)
+		errx(1, "wrong rate: %s", val);
+	a->rate_bytes = rate;
+}
+
+/*
+ * Set the target rate in accesses per millisecond, and the accesses per
+ * kernel call.  Chunks of rate limited patterns have accesses for about 100
+ * microseconds, so that the pacing is fine-grained.
+ */
+static void setup_rate(struct access *a)
+{
+	double chunk;
+
+	a->nr_chunk_accesses = nr_accesses_per_region;
+	if (a->rate_bytes)
+		a->rate = a->rate_bytes / access_bytes(a) / 1000;
+	if (!a->rate)
+		return;
+	chunk = a->rate / 10;
+	if (chunk < MAX_CHASE_CHAINS)
+		chunk = MAX_CHASE_CHAINS;
+	if (chunk < a->nr_chunk_accesses)
+		a->nr_chunk_accesses = chunk;
+}
+
+static void parse_chains_opt(char *val, struct access *a)
+{
+	if (!strcmp(val, "sweep")) {
+		a->chains_sweep = 1;
+		return;
+	}
+	a->nr_chains = atoi(val);
+}
+
+/*
+ * Parse the amount of the work of a phase, e.g., "1000000" or "64G".  K, M, G,
+ * and T suffixes are binary prefixes.
+ */
+static unsigned long long parse_work(char *val)
+{
+	unsigned long long work;
+	char *end;
+
+	work = strtoull(val, &end, 0);
+	switch (*end) {
+	case 'T':
+		work <<= 10;
+		/* fall through */
+	case 'G':
+		work <<= 10;
+		/* fall through */
+	case 'M':
+		work <<= 10;
+		/* fall through */
+	case 'K':
+		work <<= 10;
+		end++;
+		break;
+	}
+	if (!work || *end)
+		errx(1, "wrong amount of work: %s", val);
+	return work;
+}
+
+/*
+ * Parse the second line of a phase paragraph.  The line is the time of the
+ * phase in milliseconds, optionally followed by options, e.g.,
+ * "1000, threads=4, cpus=0-3".
+ */
+static void parse_phase_time(struct cfg_reader *reader, char *line,
+		struct phase *p)
+{
+	char **fields;
+	int nr_fields;
+	char *key, *val;
+	int threads_set = 0;
+	int i;
+
+	p->nr_threads = 1;
+	p->cpus = NULL;
+	p->nr_cpus = 0;
+
+	p->work = 0;
+	p->work_in_bytes = 0;
+
+	nr_fields = cfg_split(reader, line, ',');
+	fields = reader->fields;
+	p->time_ms = atoi(fields[0]);
+	for (i = 1; i < nr_fields; i++) {
+		val = parse_opt(fields[i], &key);
+		if (!val)
+			errx(1, "wrong phase option: %s", fields[i]);
+		if (!strcmp(key, "accesses") || !strcmp(key, "bytes")) {
+			p->work = parse_work(val);
+			p->work_in_bytes = !strcmp(key, "bytes");
+			continue;
+		}
+		if (parse_threads_opt(key, val, &p->nr_threads, &p->cpus,
+					&p->nr_cpus))
+			errx(1, "wrong phase option: %s", key);
+		if (!strcmp(key, "threads"))
+			threads_set = 1;
+	}
+	/* one thread per cpu, by default */
+	if (p->nr_cpus && !threads_set)
+		p->nr_threads = p->nr_cpus;
+}
+
+static void parse_trace_opt(char *val, struct access *a,
+		struct aarena *arena)
+{
+	if (!*val)
+		errx(1, "empty trace file");
+	a->trace_file = aarena_strdup(arena, val);
+	if (!a->trace_file)
+		err(1, "trace_file alloc");
+}
+
+/* Parse the replay speed, e.g., "1" for the speed of the timestamps */
+static void parse_speed_opt(char *val, struct access *a)
+{
+	char *end;
 
-		if (hintmethod == MLOCK) {
-			if (mlock(region->region, region->sz) == -1)
-				err(-1, "failed mlock");
-		} else if (hintmethod == MADVISE) {
-			/* madvise receive page size aligned region only */
-			uintptr_t aligned;
+	a->trace_speed = strtod(val, &end);
+	if (*end || a->trace_speed < 0)
+		errx(1, "wrong replay speed: %s", val);
+}
 
-			aligned = (uintptr_t)region->region;
-			if (aligned % SZ_PAGE != 0)
-				aligned = aligned + SZ_PAGE -
-					(aligned % SZ_PAGE);
+/*
+ * Parse the option fields of an access pattern line, e.g.,
+ * "threads=2, cpus=4-5".
+ */
+static void parse_access_opts(char **fields, int nr_fields, struct access *a,
+		struct aarena *arena)
+{
+	char *key, *val;
+	int threads_set = 0;
+	int i;
 
-			if (madvise((void *)aligned, region->sz,
-						MADV_WILLNEED) == -1)
-				err(-1, "failed madvise");
+	for (i = 0; i < nr_fields; i++) {
+		val = parse_opt(fields[i], &key);
+		if (!val)
+			errx(1, "wrong access pattern option: %s", fields[i]);
+		if (!parse_threads_opt(key, val, &a->nr_threads, &a->cpus,
+					&a->nr_cpus)) {
+			if (!strcmp(key, "threads"))
+				threads_set = 1;
+			continue;
 		}
+		if (!strcmp(key, "chains"))
+			parse_chains_opt(val, a);
+		else if (!strcmp(key, "width"))
+			parse_width_opt(val, a);
+		else if (!strcmp(key, "dist"))
+			parse_dist_opt(val, a);
+		else if (!strcmp(key, "offset"))
+			parse_offset_opt(val, a);
+		else if (!strcmp(key, "rate"))
+			parse_rate_opt(val, a);
+		else if (!strcmp(key, "trace"))
+			parse_trace_opt(val, a, arena);
+		else if (!strcmp(key, "speed"))
+			parse_speed_opt(val, a);
+		else
+			errx(1, "unknown access pattern option: %s", key);
 	}
+	if (a->nr_cpus && !threads_set)
+		a->nr_threads = a->nr_cpus;
 }
 
-void exec_phase(struct phase *phase)
+enum access_order parse_order(char *input)
 {
-	struct access *pattern;
-	unsigned long long nr_access, nr_last_logged_access = 0;
-	unsigned long long start, now, last_log_time;
-	int randn;
-	size_t i;
-	static unsigned long long cpu_cycle_ms;
+	char *order = strip_spaces(input);
 
-	if (!cpu_cycle_ms)
-		cpu_cycle_ms = aclk_freq() / 1000;
+	if (!strcmp(order, "0"))
+		return SEQUENTIAL;
+	else if (!strcmp(order, "1"))
+		return RANDOM;
+	else if (!strcmp(order, "chase"))
+		return CHASE;
+	else if (!strcmp(order, "shuffle"))
+		return SHUFFLE;
+	else if (!strcmp(order, "replay"))
+		return REPLAY;
+	errx(1, "wrong access order: %s", order);
+}
+
+/*
+ * Random and shuffle patterns access the offset of each stride-sized unit.
+ * Zero stride of random patterns means the width, for old configs.
+ */
+static void set_unit_stride(struct access *a)
+{
+	if (a->order == RANDOM && !a->stride)
+		a->stride = a->width;
+	if (!a->stride || a->stride % a->width)
+		errx(1, "%s stride should be multiple of the width %zu, "
+				"not %zu", a->order == RANDOM ? "random" :
+				"shuffle", a->width, a->stride);
+	if (a->unit_offset % a->width ||
+			a->unit_offset + a->width > a->stride)
+		errx(1, "offset %zu is not aligned to the width %zu or out "
+				"of the stride %zu", a->unit_offset, a->width,
+				a->stride);
+	if (a->stride > a->mregion->sz)
+		errx(1, "region %s is smaller than the stride %zu",
+				a->mregion->name, a->stride);
+}
 
-	start = aclk_clock();
-	last_log_time = start;
-	nr_access = 0;
+/*
+ * Each region can have only one chain, so all chasing patterns for a region
+ * should use same stride.
+ */
+static void set_chase_stride(struct access *a)
+{
+	struct mregion *region = a->mregion;
 
-	if (hintmethod != NONE)
-		hint_access_pattern(phase);
+	if (a->rw_mode > READ_WRITE)
+		errx(1, "chase patterns support only ro, wo, and rw");
+	if (a->stride < sizeof(size_t) || a->stride % sizeof(size_t))
+		errx(1, "chase stride should be multiple of %zu, not %zu",
+				sizeof(size_t), a->stride);
+	if (a->rw_mode != READ_ONLY && a->stride == sizeof(size_t))
+		errx(1, "chase stride for writes should be bigger than %zu",
+				sizeof(size_t));
+	if (region->sz / a->stride < 2)
+		errx(1, "region %s is too small for chasing", region->name);
+	if (region->chase_stride && region->chase_stride != a->stride)
+		errx(1, "region %s is chased with different strides",
+				region->name);
+	region->chase_stride = a->stride;
+}
 
-	while (1) {
-		if (phase->total_probability)
-			randn = rndint() % phase->total_probability;
-		else
-			randn = -1;
-		for (i = 0; i < phase->nr_patterns; i++) {
-			int prob_start, prob_end;
+static const char * const rw_mode_str[] = {
+	[READ_ONLY] = "ro",
+	[WRITE_ONLY] = "wo",
+	[READ_WRITE] = "rw",
+	[NT_WRITE_ONLY] = "nt_wo",
+	[FLUSH_WRITE_ONLY] = "flush_wo",
+	[NT_READ_ONLY] = "nt_ro",
+};
 
-			pattern = &phase->patterns[i];
-			prob_start = pattern->prob_start;
-			prob_end = prob_start + pattern->probability;
-			if (randn >= prob_start && randn < prob_end)
-				nr_access += do_access(pattern);
-		}
+/* Returns the rw mode of the name, or NR_RW_MODES if the name is wrong */
+static enum rw_mode rwmode_of(char *name)
+{
+	enum rw_mode mode;
 
-		now = aclk_clock();
-		if (!quiet && log_interval_ms &&
-				now - last_log_time >
-				cpu_cycle_ms * log_interval_ms) {
-			printf("%s:\t%'20llu accesses / %d msec\n",
-					phase->name,
-					nr_access - nr_last_logged_access,
-					log_interval_ms);
-			last_log_time = now;
-			nr_last_logged_access = nr_access;
-		}
-		if (now - start > cpu_cycle_ms * phase->time_ms)
+	for (mode = 0; mode < NR_RW_MODES; mode++) {
+		if (!strcmp(name, rw_mode_str[mode]))
 			break;
 	}
-	if (!quiet && !log_interval_ms)
-		printf("%s:\t%'20llu accesses/msec, %llu msecs run\n",
-				phase->name,
-				nr_access /
-				((aclk_clock() - start) / cpu_cycle_ms),
-				((aclk_clock() - start) / cpu_cycle_ms));
+	return mode;
 }
 
-static void load_init_data(struct mregion *region)
+enum rw_mode parse_rwmode(char *input)
 {
-	int fd;
-	char buffer[4096];
-	ssize_t bytes_read;
-	size_t data_filled = 0;
-
-	if (!region->data_file)
-		return;
+	char *rwmode = strip_spaces(input);
+	enum rw_mode mode = rwmode_of(rwmode);
 
-	fd = open(region->data_file, O_RDONLY);
-	if (fd == -1) {
-		perror("init data load, open");
+	if (mode == NR_RW_MODES) {
+		fprintf(stderr, "wrong rw mode: %s\n", rwmode);
 		exit(1);
 	}
-	while (data_filled < region->sz) {
-		bytes_read = read(fd, buffer, 4096);
-		if (bytes_read == -1) {
-			perror("init data load, read");
-			close(fd);
-			exit(1);
-		}
-		if (bytes_read > region->sz - data_filled)
-			bytes_read = region->sz - data_filled;
-		memcpy(&region->region[data_filled], buffer, bytes_read);
-		data_filled += bytes_read;
-	}
-	close(fd);
+	return mode;
 }
 
-static void init_region(struct mregion *region)
+/*
+ * Build the alias table for constant time selection of the patterns that
+ * are executed by the shared phase threads.
+ */
+static void build_phase_alias(struct phase *p)
 {
-	if (use_hugetlb) {
-		region->region = mmap(HUGETLB_ADDR, region->sz,
-				HUGETLB_PROTECTION, HUGETLB_FLAGS, -1,
-				0);
-		if (region->region == MAP_FAILED) {
-			perror("mmap");
-			exit(1);
-		}
-	} else {
-		region->region = (char *)malloc(region->sz);
-	}
-	load_init_data(region);
+	unsigned *weights;
+	int i;
+
+	memset(&p->alias, 0, sizeof(p->alias));
+	if (!p->total_probability)
+		return;
+	weights = malloc(sizeof(*weights) * p->nr_patterns);
+	if (!weights)
+		err(1, "alias weights alloc");
+	for (i = 0; i < p->nr_patterns; i++)
+		weights[i] = p->patterns[i].nr_threads ? 0 :
+			p->patterns[i].probability;
+	avgn_alias_init(&p->alias, weights, p->nr_patterns);
+	free(weights);
 }
 
-void exec_config(struct access_config *config)
+/*
+ * Map the trace file of the replay pattern @a.  The records can refer to all
+ * regions of @config.
+ */
+static void open_trace(struct access *a, struct access_config *config)
 {
-	struct mregion *region;
-	size_t i;
+	struct mtrace *trace;
+	struct mtr_header *h;
+	struct stat sb;
+	ssize_t i;
+	int fd;
 
-	for (i = 0; i < config->nr_regions; i++)
-		init_region(&config->regions[i]);
+	trace = calloc(1, sizeof(*trace));
+	if (!trace)
+		err(1, "trace alloc");
+	fd = open(a->trace_file, O_RDONLY);
+	if (fd == -1)
+		err(1, "open(\"%s\") failed", a->trace_file);
+	if (fstat(fd, &sb))
+		err(1, "fstat() for trace file (%s) failed", a->trace_file);
+	if (sb.st_size < sizeof(*h) + sizeof(*trace->records))
+		errx(1, "trace file %s has no record", a->trace_file);
+	trace->map_sz = sb.st_size;
+	trace->map = mmap(NULL, trace->map_sz, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (trace->map == MAP_FAILED)
+		err(1, "mmap() for trace file (%s) failed", a->trace_file);
+	close(fd);
+	madvise(trace->map, trace->map_sz, MADV_SEQUENTIAL);
 
-	for (i = 0; i < config->nr_phases; i++)
-		exec_phase(&config->phases[i]);
+	h = trace->map;
+	if (memcmp(h->magic, MTR_MAGIC, sizeof(h->magic)) ||
+			h->version != MTR_VERSION ||
+			h->byte_order != MSB_BYTE_ORDER)
+		errx(1, "%s is not a trace file of version %u in this byte "
+				"order", a->trace_file, MTR_VERSION);
+	trace->records = (struct mtr_record *)(h + 1);
+	trace->nr_records = (trace->map_sz - sizeof(*h)) /
+		sizeof(*trace->records);
+	trace->timestamps = h->flags & MTR_TIMESTAMPS;
+	if (a->trace_speed && !trace->timestamps)
+		errx(1, "trace file %s has no timestamp for the speed",
+				a->trace_file);
+
+	/* next pass starts after the average interval of the records */
+	trace->start_ns = trace->records[0].ts_ns;
+	trace->period_ns = trace->records[trace->nr_records - 1].ts_ns -
+		trace->start_ns;
+	if (trace->nr_records > 1)
+		trace->period_ns += trace->period_ns /
+			(trace->nr_records - 1);
+	if (!trace->period_ns)
+		trace->period_ns = 1;
 
 	for (i = 0; i < config->nr_regions; i++) {
-		region = &config->regions[i];
-		if (use_hugetlb)
-			munmap(HUGETLB_ADDR, region->sz);
-		else
-			free(region->region);
+		if (config->regions[i].sz < a->width)
+			errx(1, "region %s is smaller than the width %zu",
+					config->regions[i].name, a->width);
 	}
+	trace->regions = config->regions;
+	trace->nr_regions = config->nr_regions;
+	a->trace = trace;
 }
 
-size_t len_line(char *str, size_t lim_seek)
+static void close_trace(struct mtrace *trace)
 {
-	size_t i;
+	if (!trace)
+		return;
+	munmap(trace->map, trace->map_sz);
+	free(trace);
+}
 
-	for (i = 0; i < lim_seek; i++) {
-		if (str[i] == '\n')
-			break;
+/*
+ * Validate the options of @a that depend on each other.  Those are checked
+ * after all options are set, for both the config and the compiled config.
+ */
+static void check_pattern_opts(struct access *a)
+{
+	switch (a->width) {
+	case 1:
+	case 8:
+	case 16:
+	case 32:
+	case 64:
+		break;
+	default:
+		errx(1, "wrong access width: %zu", a->width);
 	}
+	if (a->order == CHASE && a->width != 1)
+		errx(1, "width option is not for chase patterns");
+	if (a->width > a->mregion->sz)
+		errx(1, "region %s is smaller than the width %zu",
+				a->mregion->name, a->width);
+	if (a->order == SEQUENTIAL && a->stride % a->width)
+		errx(1, "stride %zu is not aligned to the width %zu",
+				a->stride, a->width);
+	if (a->dist != UNIFORM && a->order != RANDOM)
+		errx(1, "dist option is only for random patterns");
+	if (a->unit_offset && a->order != RANDOM && a->order != SHUFFLE)
+		errx(1, "offset option is only for random and shuffle patterns");
+	if ((a->nr_chains != 1 || a->chains_sweep) && a->order != CHASE)
+		errx(1, "chains option is only for chase patterns");
+	if (a->nr_chains < 1 || a->nr_chains > MAX_CHASE_CHAINS)
+		errx(1, "number of chains should be in [1, %d], not %d",
+				MAX_CHASE_CHAINS, a->nr_chains);
+	if (a->rate < 0 || a->rate_bytes < 0)
+		errx(1, "wrong rate");
+	if (a->order == REPLAY && !a->trace_file)
+		errx(1, "replay patterns need trace option");
+	if (a->order != REPLAY && (a->trace_file || a->trace_speed))
+		errx(1, "trace and speed options are for replay patterns only");
+}
 
-	if (i == lim_seek)
-		return -1;
-
-	return i;
+/* Validate @a and set up the fields of @a that derived from the options */
+static void setup_pattern(struct access *a, struct access_config *config)
+{
+	check_pattern_opts(a);
+	if (a->order == CHASE)
+		set_chase_stride(a);
+	else if (a->order == REPLAY)
+		open_trace(a, config);
+	else if (a->order != SEQUENTIAL)
+		set_unit_stride(a);
+	setup_dist(a);
+	setup_rate(a);
+	a->fn = access_fn_of(a);
+	a->last_offset = 0;
 }
 
-/* Read exactly required bytes from a file */
-void readall(int file, char *buf, ssize_t sz)
+/* Parse an access pattern line of a phase */
+static void parse_pattern(struct cfg_reader *reader, char *line,
+		struct access *a, struct access_config *config,
+		struct ahash *region_names)
 {
-	ssize_t sz_read;
-	ssize_t sz_total_read = 0;
-	while (1) {
-		sz_read = read(file, buf + sz_total_read, sz - sz_total_read);
-		if (sz_read == -1)
-			err(1, "read() failed!");
-		sz_total_read += sz_read;
-		if (sz_total_read == sz)
-			return;
+	char **fields;
+	int nr_fields;
+	int k;
+
+	nr_fields = cfg_split(reader, line, ',');
+	fields = reader->fields;
+	if (nr_fields < 4)
+		errx(1, "Wrong number of fields! %s", line);
+	k = ahash_get(region_names, fields[0]);
+	if (k < 0)
+		errx(1, "Cannot find region with name %s", fields[0]);
+	a->mregion = &config->regions[k];
+	a->order = parse_order(fields[1]);
+	a->stride = atoi(fields[2]);
+	a->probability = atoi(fields[3]);
+	a->nr_threads = 0;
+	a->cpus = NULL;
+	a->nr_cpus = 0;
+	a->width = 1;
+	a->unit_offset = 0;
+	a->rate = 0;
+	a->rate_bytes = 0;
+	a->dist = UNIFORM;
+	a->dist_args[0] = a->dist_args[1] = 0;
+	a->nr_chains = 1;
+	a->chains_sweep = 0;
+	a->trace_file = NULL;
+	a->trace = NULL;
+	a->trace_speed = 0;
+	k = 4;
+	if (nr_fields > 4 && !strchr(fields[4], '=')) {
+		a->rw_mode = parse_rwmode(fields[4]);
+		k++;
+	} else {
+		a->rw_mode = default_rw_mode;
 	}
+	parse_access_opts(&fields[k], nr_fields - k, a, reader->arena);
+	setup_pattern(a, config);
 }
 
-char *rm_comments(char *orig)
+/**
+ * parse_phase - Parse a phase paragraph
+ *
+ * @reader		Reader of the config file.
+ * @name		First line of the paragraph, the name of the phase.
+ * @p			The phase to store the result.
+ * @config		Config having the regions.
+ * @region_names	Hash table of the names of the regions.
+ *
+ * The patterns are gathered in @reader->patterns, and copied to the arena
+ * at the end of the paragraph.
+ */
+static void parse_phase(struct cfg_reader *reader, char *name,
+		struct phase *p, struct access_config *config,
+		struct ahash *region_names)
 {
-	char *read_cursor;
-	char *write_cursor;
-	size_t len;
-	size_t offset;
-	char *result;
-	size_t origsz;
-
-	origsz = strlen(orig) + 1;
-	result = (char *)malloc(origsz);
-	read_cursor = orig;
-	write_cursor = result;
-	offset = 0;
-	while (1) {
-		read_cursor = orig + offset;
-		len = len_line(read_cursor, origsz - offset);
-		if (len == -1)
-			break;
-		if (read_cursor[0] == '#')
-			goto nextline;
-		strncpy(write_cursor, read_cursor, len + 1);
-		write_cursor += len + 1;
-nextline:
-		offset += len + 1;
+	struct access *a;
+	char *line;
+	int nr_patterns = 0;
+
+	p->name = aarena_strdup(reader->arena, name);
+	if (!p->name)
+		err(1, "phase name alloc");
+	line = cfg_next_line(reader);
+	if (!line || !*line)
+		errx(1, "%s: no time line for phase %s", __func__, p->name);
+	parse_phase_time(reader, line, p);
+	p->total_probability = 0;
+
+	for (line = cfg_next_line(reader); line && *line;
+			line = cfg_next_line(reader)) {
+		if (nr_patterns == reader->max_patterns) {
+			reader->max_patterns = reader->max_patterns ?
+				reader->max_patterns * 2 : 16;
+			reader->patterns = realloc(reader->patterns,
+					sizeof(*reader->patterns) *
+					reader->max_patterns);
+			if (!reader->patterns)
+				err(1, "patterns alloc");
+		}
+		a = &reader->patterns[nr_patterns];
+		parse_pattern(reader, line, a, config, region_names);
+		a->idx = nr_patterns++;
+		/* patterns having dedicated threads are not selected randomly */
+		if (!a->nr_threads)
+			p->total_probability += a->probability;
 	}
-	*write_cursor = '\0';
+	if (!nr_patterns)
+		errx(1, "%s: no access pattern for phase %s", __func__,
+				p->name);
 
-	return result;
+	p->nr_patterns = nr_patterns;
+	p->patterns = aarena_alloc(reader->arena,
+			sizeof(*p->patterns) * nr_patterns);
+	if (!p->patterns)
+		err(1, "patterns alloc");
+	memcpy(p->patterns, reader->patterns,
+			sizeof(*p->patterns) * nr_patterns);
+	build_phase_alias(p);
 }
 
-ssize_t paragraph_len(char *str, ssize_t len)
+/* Parse the phases, which are all paragraphs after the regions paragraph */
+static void parse_phases(struct cfg_reader *reader,
+		struct access_config *config)
 {
+	struct ahash region_names;
+	size_t max_phases = 0;
+	char *line;
 	ssize_t i;
 
-	for (i = 0; i < len - 1; i++) {
-		if (str[i] == '\n' && str[i + 1] == '\n')
-			return i;
+	if (ahash_init(&region_names, config->nr_regions))
+		err(1, "region names hash alloc");
+	for (i = 0; i < config->nr_regions; i++) {
+		if (ahash_set(&region_names, config->regions[i].name, i))
+			errx(1, "duplicated region name %s",
+					config->regions[i].name);
 	}
-	return -1;
+
+	config->phases = NULL;
+	config->nr_phases = 0;
+	while ((line = cfg_next_paragraph(reader))) {
+		if (config->nr_phases == max_phases) {
+			max_phases = max_phases ? max_phases * 2 : 16;
+			config->phases = realloc(config->phases,
+					sizeof(*config->phases) * max_phases);
+			if (!config->phases)
+				err(1, "phases alloc");
+		}
+		parse_phase(reader, line,
+				&config->phases[config->nr_phases++], config,
+				&region_names);
+	}
+	if (!config->nr_phases)
+		errx(1, "Wrong file format: no phase");
+	ahash_free(&region_names);
 }
 
-size_t parse_regions(char *str, struct mregion **regions_ptr)
-{
-	int i;
-	struct mregion *regions;
-	struct mregion *r;
-	size_t nr_regions;
-	char **lines;
-	char **fields;
-	int nr_fields;
+/* A buffer for building a compiled config */
+struct msb_buf {
+	char *data;
+	size_t len;
+	size_t sz;
+};
 
-	nr_regions = astr_split(str, '\n', &lines);
-	if (nr_regions < 1)
-		err(1, "Not enough lines");
-	regions = (struct mregion *)malloc(sizeof(struct mregion) * nr_regions);
+/* Append @len bytes of @data to @buf, and returns the offset of the bytes */
+static size_t msb_append(struct msb_buf *buf, const void *data, size_t len)
+{
+	size_t off = buf->len;
 
-	for (i = 0; i < nr_regions; i++) {
-		r = &regions[i];
-		nr_fields = astr_split(lines[i], ',', &fields);
-		if (nr_fields != 2 && nr_fields != 3)
-			err(1, "Wrong format config file: %s", lines[i]);
-		strcpy(r->name, fields[0]);
-		r->sz = atoll(fields[1]);
-		if (nr_fields == 2) {
-			r->data_file = NULL;
-		} else {
-			r->data_file = malloc(sizeof(char) *
-					(strlen(fields[2]) + 1));
-			if (!r->data_file)
-				err(1, "data_file alloc");
-			sscanf(fields[2], "%s", r->data_file);
-			if (!strcmp("none", r->data_file)) {
-				free(r->data_file);
-				r->data_file = NULL;
-			}
-		}
-		astr_free_str_array(fields, nr_fields);
+	if (buf->len + len > buf->sz) {
+		buf->sz = buf->len + len > buf->sz * 2 ?
+			buf->len + len : buf->sz * 2;
+		buf->data = realloc(buf->data, buf->sz);
+		if (!buf->data)
+			err(1, "msb buffer alloc");
 	}
+	memcpy(buf->data + off, data, len);
+	buf->len += len;
+	return off;
+}
 
-	astr_free_str_array(lines, nr_regions);
-	*regions_ptr = regions;
+/* Returns the offset of @str in the string table @strs, or MSB_NONE */
+static uint32_t msb_str(struct msb_buf *strs, const char *str)
+{
+	size_t off;
 
-	return nr_regions;
+	if (!str)
+		return MSB_NONE;
+	off = msb_append(strs, str, strlen(str) + 1);
+	if (off >= MSB_NONE)
+		errx(1, "too many strings for the compiled config");
+	return off;
 }
 
-enum rw_mode parse_rwmode(char *input)
+/* Returns the index of the first of @nr @ids in the id array @ids_buf */
+static uint32_t msb_ids(struct msb_buf *ids_buf, const int *ids, int nr)
 {
-	char *rwmode = malloc(strlen(input) + 1);
-
-	sscanf(input, "%s", rwmode);
+	uint32_t idx = ids_buf->len / sizeof(int32_t);
+	int32_t id;
+	int i;
 
-	if (!strncmp(rwmode, "ro", 2)) {
-		return READ_ONLY;
-	} else if (!strncmp(rwmode, "wo", 2)) {
-		return WRITE_ONLY;
-	} else if (!strncmp(rwmode, "rw", 2)) {
-		return READ_WRITE;
-	} else {
-		fprintf(stderr, "wrong rw mode: %s\n", rwmode);
-		exit(1);
+	for (i = 0; i < nr; i++) {
+		id = ids[i];
+		msb_append(ids_buf, &id, sizeof(id));
 	}
+	return idx;
 }
 
-/**
- * parse_phase - Parse a phase from string lines
- *
- * Return number of lines for this phase
+/* Append @buf to @file at 8 bytes aligned offset, and returns the offset */
+static uint64_t msb_append_section(struct msb_buf *file, struct msb_buf *buf)
+{
+	static const char zeros[8];
+
+	msb_append(file, zeros, (8 - file->len % 8) % 8);
+	return msb_append(file, buf->data, buf->len);
+}
+
+/*
+ * Write @config to @path in the compiled config format.  The region of each
+ * pattern is written as the index of the region.
  */
-int parse_phase(char *lines[], int nr_lines, struct phase *p,
-		size_t nr_regions, struct mregion *regions)
+static void write_msb(struct access_config *config, char *path)
 {
-	struct access *patterns;
-	char **fields;
-	int nr_fields;
+	struct msb_buf file = {}, regions = {}, phases = {}, patterns = {};
+	struct msb_buf ids = {}, strs = {};
+	struct msb_header header = {};
+	struct msb_region mr;
+	struct msb_phase mp;
+	struct msb_pattern ma;
+	struct mregion *r;
+	struct phase *p;
 	struct access *a;
-	int j, k;
-
-	if (nr_lines < 3)
-		errx(1, "%s: Wrong number of lines! %d\n", __func__, nr_lines);
+	int nodes[MAX_NUMA_NODES];
+	ssize_t i;
+	int j, nr_nodes;
+	FILE *f;
 
-	p->name = (char *)malloc((strlen(lines[0]) + 1) * sizeof(char));
-	strcpy(p->name, lines[0]);
-	p->time_ms = atoi(lines[1]);
-	p->nr_patterns = nr_lines - 2;
-	p->total_probability = 0;
-	lines += 2;
-	patterns = (struct access *)malloc(p->nr_patterns *
-			sizeof(struct access));
-	p->patterns = patterns;
-	for (j = 0; j < p->nr_patterns; j++) {
-		nr_fields = astr_split(lines[0], ',', &fields);
-		if (nr_fields != 4 && nr_fields != 5)
-			err(1, "Wrong number of fields! %s\n",
-					lines[0]);
-		a = &patterns[j];
-		a->mregion = NULL;
-		for (k = 0; k < nr_regions; k++) {
-			if (strcmp(fields[0], regions[k].name) == 0) {
-				a->mregion = &regions[k];
-				break;
-			}
+	for (i = 0; i < config->nr_regions; i++) {
+		r = &config->regions[i];
+		memset(&mr, 0, sizeof(mr));
+		mr.sz = r->sz;
+		mr.name = msb_str(&strs, r->name);
+		mr.data_file = msb_str(&strs, r->data_file);
+		mr.backing_file = msb_str(&strs, r->backing_file);
+		mr.numa_mode = r->numa_mode;
+		for (j = 0, nr_nodes = 0; j < MAX_NUMA_NODES; j++) {
+			if (r->nodemask[j / LONG_BITS] & (1UL << (j % LONG_BITS)))
+				nodes[nr_nodes++] = j;
 		}
-		if (a->mregion == NULL)
-			err(1, "Cannot find region with name %s",
-					fields[0]);
-		a->random_access = atoi(fields[1]);
-		a->stride = atoi(fields[2]);
-		a->probability = atoi(fields[3]);
-		if (nr_fields == 5) {
-			a->rw_mode = parse_rwmode(fields[4]);
-		} else {
-			a->rw_mode = default_rw_mode;
+		mr.nodes = msb_ids(&ids, nodes, nr_nodes);
+		mr.nr_nodes = nr_nodes;
+		mr.pages = r->pages;
+		mr.backing = r->backing;
+		mr.populate = r->populate;
+		mr.load = r->load;
+		msb_append(&regions, &mr, sizeof(mr));
+	}
+
+	for (i = 0; i < config->nr_phases; i++) {
+		p = &config->phases[i];
+		memset(&mp, 0, sizeof(mp));
+		mp.name = msb_str(&strs, p->name);
+		mp.time_ms = p->time_ms;
+		mp.nr_threads = p->nr_threads;
+		mp.cpus = msb_ids(&ids, p->cpus, p->nr_cpus);
+		mp.nr_cpus = p->nr_cpus;
+		mp.patterns = header.nr_patterns;
+		mp.nr_patterns = p->nr_patterns;
+		mp.work = p->work;
+		mp.work_in_bytes = p->work_in_bytes;
+		msb_append(&phases, &mp, sizeof(mp));
+		for (j = 0; j < p->nr_patterns; j++) {
+			a = &p->patterns[j];
+			memset(&ma, 0, sizeof(ma));
+			ma.region = a->mregion - config->regions;
+			ma.order = a->order;
+			ma.rw_mode = a->rw_mode;
+			ma.dist = a->dist;
+			ma.chains_sweep = a->chains_sweep;
+			ma.stride = a->stride;
+			ma.width = a->width;
+			ma.unit_offset = a->unit_offset;
+			memcpy(ma.dist_args, a->dist_args, sizeof(ma.dist_args));
+			ma.rate = a->rate;
+			ma.rate_bytes = a->rate_bytes;
+			ma.probability = a->probability;
+			ma.nr_threads = a->nr_threads;
+			ma.cpus = msb_ids(&ids, a->cpus, a->nr_cpus);
+			ma.nr_cpus = a->nr_cpus;
+			ma.nr_chains = a->nr_chains;
+			ma.trace_file = msb_str(&strs, a->trace_file);
+			ma.trace_speed = a->trace_speed;
+			msb_append(&patterns, &ma, sizeof(ma));
 		}
-		a->prob_start = p->total_probability;
-		a->last_offset = 0;
-		lines++;
-		astr_free_str_array(fields, nr_fields);
-		p->total_probability += a->probability;
+		header.nr_patterns += p->nr_patterns;
 	}
-	return 2 + p->nr_patterns;
+
+	memcpy(header.magic, MSB_MAGIC, sizeof(header.magic));
+	header.version = MSB_VERSION;
+	header.byte_order = MSB_BYTE_ORDER;
+	header.nr_regions = config->nr_regions;
+	header.nr_phases = config->nr_phases;
+	header.nr_ids = ids.len / sizeof(int32_t);
+	msb_append(&file, &header, sizeof(header));
+	header.regions_off = msb_append_section(&file, &regions);
+	header.phases_off = msb_append_section(&file, &phases);
+	header.patterns_off = msb_append_section(&file, &patterns);
+	header.ids_off = msb_append_section(&file, &ids);
+	header.strs_off = msb_append_section(&file, &strs);
+	header.strs_sz = strs.len;
+	header.file_sz = file.len;
+	memcpy(file.data, &header, sizeof(header));
+
+	f = fopen(path, "w");
+	if (!f)
+		err(1, "open(\"%s\") failed", path);
+	if (fwrite(file.data, 1, file.len, f) != file.len || fclose(f))
+		err(1, "writing %s failed", path);
+
+	free(file.data);
+	free(regions.data);
+	free(phases.data);
+	free(patterns.data);
+	free(ids.data);
+	free(strs.data);
 }
 
-size_t parse_phases(char *str, struct phase **phases_ptr,
-		size_t nr_regions, struct mregion *regions)
+/* Returns the string of offset @off in the string table of @msb */
+static char *msb_str_of(char *msb, struct msb_header *h, uint32_t off)
 {
-	struct phase *phases;
-	struct phase *p;
-	size_t nr_phases;
-	char **lines_orig;
-	char **lines;
-	int nr_lines;
-	int nr_lines_paragraph;
-	int i, j;
+	if (off == MSB_NONE)
+		return NULL;
+	if (off >= h->strs_sz)
+		errx(1, "wrong string offset %u in the compiled config", off);
+	return msb + h->strs_off + off;
+}
 
-	nr_phases = 0;
-	nr_lines = astr_split(str, '\n', &lines_orig);
-	lines = lines_orig;
-	if (nr_lines < 3)	/* phase name, time, pattern */
-		err(1, "Not enough lines for phases %s", str);
+/* Returns a copy of @nr ids from @idx-th id of @msb, or NULL if @nr is 0 */
+static int *msb_ids_of(char *msb, struct msb_header *h, uint32_t idx,
+		uint32_t nr)
+{
+	int32_t *ids = (int32_t *)(msb + h->ids_off);
+	int *ret;
 
-	for (i = 0; i < nr_lines; i++) {
-		if (lines_orig[i][0] == '\0')
-			nr_phases++;
-	}
+	if (!nr)
+		return NULL;
+	if (idx > h->nr_ids || nr > h->nr_ids - idx)
+		errx(1, "wrong ids in the compiled config");
+	ret = malloc(sizeof(*ret) * nr);
+	if (!ret)
+		err(1, "ids alloc");
+	memcpy(ret, &ids[idx], sizeof(*ret) * nr);
+	return ret;
+}
 
-	phases = (struct phase *)malloc(nr_phases * sizeof(struct phase));
+/* Returns if @nr entries of @entry_sz bytes at @off are in @len bytes file */
+static int msb_in_file(uint64_t off, uint64_t nr, size_t entry_sz,
+		size_t len)
+{
+	return off % 8 == 0 && off <= len && nr <= (len - off) / entry_sz;
+}
 
-	for (i = 0; i < nr_phases; i++) {
-		nr_lines_paragraph = 0;
-		for (j = 0; j < nr_lines; j++) {
-			if (lines[j][0] == '\0')
-				break;
-			nr_lines_paragraph++;
-		}
+/*
+ * Load the config from the compiled config @msb of @len bytes.  The file is
+ * validated, but not parsed.  The strings of the config are pointing the
+ * file, so @msb should be kept mapped while @config is used.
+ */
+static void load_msb(char *msb, size_t len, struct access_config *config)
+{
+	struct msb_header *h = (struct msb_header *)msb;
+	struct msb_region *mr;
+	struct msb_phase *mp;
+	struct msb_pattern *ma;
+	struct mregion *r;
+	struct phase *p;
+	struct access *a;
+	char *name;
+	int *nodes;
+	uint32_t i, j;
+
+	if (h->version != MSB_VERSION)
+		errx(1, "compiled config version %u is not %u", h->version,
+				MSB_VERSION);
+	if (h->byte_order != MSB_BYTE_ORDER)
+		errx(1, "compiled config is for other byte order");
+	if (h->file_sz != len ||
+			!msb_in_file(h->regions_off, h->nr_regions,
+				sizeof(*mr), len) ||
+			!msb_in_file(h->phases_off, h->nr_phases,
+				sizeof(*mp), len) ||
+			!msb_in_file(h->patterns_off, h->nr_patterns,
+				sizeof(*ma), len) ||
+			!msb_in_file(h->ids_off, h->nr_ids, sizeof(int32_t),
+				len) ||
+			!msb_in_file(h->strs_off, h->strs_sz, 1, len) ||
+			!h->strs_sz || msb[h->strs_off + h->strs_sz - 1])
+		errx(1, "compiled config is truncated or corrupted");
+	if (!h->nr_regions || !h->nr_phases)
+		errx(1, "compiled config has no region or phase");
 
-		p = &phases[i];
-		lines += parse_phase(&lines[0], nr_lines_paragraph,
-				p, nr_regions, regions) + 1;
+	config->nr_regions = h->nr_regions;
+	config->regions = calloc(h->nr_regions, sizeof(*config->regions));
+	if (!config->regions)
+		err(1, "regions alloc");
+	mr = (struct msb_region *)(msb + h->regions_off);
+	for (i = 0; i < h->nr_regions; i++, mr++) {
+		r = &config->regions[i];
+		name = msb_str_of(msb, h, mr->name);
+		if (!name || strlen(name) >= sizeof(r->name))
+			errx(1, "wrong region name in the compiled config");
+		strcpy(r->name, name);
+		r->sz = mr->sz;
+		r->data_file = msb_str_of(msb, h, mr->data_file);
+		r->backing_file = msb_str_of(msb, h, mr->backing_file);
+		if (mr->numa_mode < 0 ||
+				mr->numa_mode >= LEN_ARRAY(numa_mode_str) ||
+				!numa_mode_str[mr->numa_mode] ||
+				mr->pages >= NR_PAGE_POLICIES ||
+				mr->backing >= NR_REGION_BACKINGS ||
+				mr->populate >= LEN_ARRAY(region_populate_str) ||
+				mr->load >= LEN_ARRAY(region_load_str))
+			errx(1, "wrong region %s in the compiled config",
+					r->name);
+		r->backing = mr->backing;
+		if (region_is_file(r) != !!r->backing_file)
+			errx(1, "wrong backing of region %s in the compiled "
+					"config", r->name);
+		r->numa_mode = mr->numa_mode;
+		nodes = msb_ids_of(msb, h, mr->nodes, mr->nr_nodes);
+		for (j = 0; j < mr->nr_nodes; j++) {
+			if (nodes[j] < 0 || nodes[j] >= MAX_NUMA_NODES)
+				errx(1, "wrong node %d in the compiled config",
+						nodes[j]);
+			r->nodemask[nodes[j] / LONG_BITS] |=
+				1UL << (nodes[j] % LONG_BITS);
+		}
+		free(nodes);
+		r->pages = mr->pages;
+		if (r->pages == PAGES_DEFAULT && use_hugetlb)
+			r->pages = PAGES_HUGETLB;
+		r->populate = mr->populate;
+		r->load = mr->load;
 	}
-	astr_free_str_array(lines_orig, nr_lines);
 
-	*phases_ptr = phases;
-	return nr_phases;
+	config->nr_phases = h->nr_phases;
+	config->phases = calloc(h->nr_phases, sizeof(*config->phases));
+	if (!config->phases)
+		err(1, "phases alloc");
+	mp = (struct msb_phase *)(msb + h->phases_off);
+	for (i = 0; i < h->nr_phases; i++, mp++) {
+		p = &config->phases[i];
+		p->name = msb_str_of(msb, h, mp->name);
+		if (!p->name || !mp->nr_patterns ||
+				mp->patterns > h->nr_patterns ||
+				mp->nr_patterns > h->nr_patterns - mp->patterns)
+			errx(1, "wrong phase %u in the compiled config", i);
+		p->time_ms = mp->time_ms;
+		p->work = mp->work;
+		p->work_in_bytes = !!mp->work_in_bytes;
+		p->nr_threads = mp->nr_threads;
+		p->cpus = msb_ids_of(msb, h, mp->cpus, mp->nr_cpus);
+		p->nr_cpus = mp->nr_cpus;
+		p->nr_patterns = mp->nr_patterns;
+		p->patterns = aarena_alloc(&config->arena,
+				sizeof(*p->patterns) * p->nr_patterns);
+		if (!p->patterns)
+			err(1, "patterns alloc");
+		memset(p->patterns, 0, sizeof(*p->patterns) * p->nr_patterns);
+		p->total_probability = 0;
+		ma = (struct msb_pattern *)(msb + h->patterns_off) +
+			mp->patterns;
+		for (j = 0; j < mp->nr_patterns; j++, ma++) {
+			a = &p->patterns[j];
+			if (ma->region >= h->nr_regions ||
+					ma->order > REPLAY ||
+					ma->rw_mode >= NR_RW_MODES ||
+					ma->dist >= NR_ACCESS_DISTS ||
+					ma->probability < 0)
+				errx(1, "wrong pattern %u of phase %s in the "
+						"compiled config", j, p->name);
+			a->mregion = &config->regions[ma->region];
+			a->order = ma->order;
+			a->rw_mode = ma->rw_mode;
+			a->dist = ma->dist;
+			a->chains_sweep = ma->chains_sweep;
+			a->stride = ma->stride;
+			a->width = ma->width;
+			a->unit_offset = ma->unit_offset;
+			memcpy(a->dist_args, ma->dist_args,
+					sizeof(a->dist_args));
+			a->rate = ma->rate;
+			a->rate_bytes = ma->rate_bytes;
+			a->probability = ma->probability;
+			a->nr_threads = ma->nr_threads;
+			a->cpus = msb_ids_of(msb, h, ma->cpus, ma->nr_cpus);
+			a->nr_cpus = ma->nr_cpus;
+			a->nr_chains = ma->nr_chains;
+			a->trace_file = msb_str_of(msb, h, ma->trace_file);
+			a->trace_speed = ma->trace_speed;
+			setup_pattern(a, config);
+			a->idx = j;
+			if (!a->nr_threads)
+				p->total_probability += a->probability;
+		}
+		build_phase_alias(p);
+	}
 }
 
 void read_config(char *cfgpath, struct access_config *config_ptr)
 {
+	struct cfg_reader reader = {};
 	struct stat sb;
-	char *cfgstr;
 	int f;
-	char *content;
-	int len_paragraph;
-	size_t nr_regions;
-	struct mregion *mregions;
-
-	size_t nr_phases;
-	struct phase *phases;
 
 	f = open(cfgpath, O_RDONLY);
 	if (f == -1)
 		err(1, "open(\"%s\") failed", cfgpath);
 	if (fstat(f, &sb))
 		err(1, "fstat() for config file (%s) failed", cfgpath);
-	cfgstr = (char *)malloc(sb.st_size * sizeof(char));
-	readall(f, cfgstr, sb.st_size);
+	if (!sb.st_size)
+		errx(1, "Wrong file format: empty config file %s", cfgpath);
+	reader.len = sb.st_size;
+	reader.buf = mmap(NULL, reader.len, PROT_READ, MAP_PRIVATE, f, 0);
+	if (reader.buf == MAP_FAILED)
+		err(1, "mmap() for config file (%s) failed", cfgpath);
 	close(f);
+	madvise(reader.buf, reader.len, MADV_SEQUENTIAL);
 
-	content = rm_comments(cfgstr);
-	free(cfgstr);
+	memset(config_ptr, 0, sizeof(*config_ptr));
+	if (reader.len >= sizeof(struct msb_header) &&
+			!memcmp(reader.buf, MSB_MAGIC, 8)) {
+		/* the strings of the config are kept in the mapping */
+		load_msb(reader.buf, reader.len, config_ptr);
+		config_ptr->msb = reader.buf;
+		config_ptr->msb_sz = reader.len;
+		return;
+	}
+	reader.arena = &config_ptr->arena;
+	parse_regions(&reader, config_ptr);
+	parse_phases(&reader, config_ptr);
 
-	len_paragraph = paragraph_len(content, strlen(content));
-	if (len_paragraph == -1)
-		err(1, "Wrong file format");
-	content[len_paragraph] = '\0';
-	nr_regions = parse_regions(content, &mregions);
+	munmap(reader.buf, reader.len);
+	free(reader.line);
+	free(reader.fields);
+	free(reader.patterns);
+}
 
-	content += len_paragraph + 2;	/* plus 2 for '\n\n' */
-	nr_phases = parse_phases(content, &phases, nr_regions, mregions);
+/* Free @config that read by read_config(), after releasing its regions */
+void free_config(struct access_config *config)
+{
+	struct phase *phase;
+	size_t i;
+	int j;
 
-	config_ptr->regions = mregions;
-	config_ptr->nr_regions = nr_regions;
-	config_ptr->phases = phases;
-	config_ptr->nr_phases = nr_phases;
+	if (config->regions_ready)
+		release_regions(config);
+	for (i = 0; i < config->nr_phases; i++) {
+		phase = &config->phases[i];
+		for (j = 0; j < phase->nr_patterns; j++) {
+			free(phase->patterns[j].cpus);
+			close_trace(phase->patterns[j].trace);
+		}
+		free(phase->cpus);
+		avgn_alias_free(&phase->alias);
+	}
+	free(config->phases);
+	free(config->regions);
+	aarena_free(&config->arena);
+	if (config->msb)
+		munmap(config->msb, config->msb_sz);
 }
 
 static struct argp_option options[] = {
@@ -775,17 +4465,25 @@ static struct argp_option options[] = {
 	{
 		.name = "default_rw_mode",
 		.key = 'r',
-		.arg = "<ro|wo|rw>",
+		.arg = "<ro|wo|rw|nt_wo|flush_wo|nt_ro>",
 		.flags = 0,
 		.doc = "set default read/write mode as this",
 		.group = 0,
 	},
+	{
+		.name = "keep_regions",
+		.key = 10,
+		.arg = 0,
+		.flags = 0,
+		.doc = "keep the regions mapped across the repeats",
+		.group = 0,
+	},
 	{
 		.name = "use_hugetlb",
 		.key = 'h',
 		.arg = 0,
 		.flags = 0,
-		.doc = "use hugepages",
+		.doc = "use hugetlb pages for regions not having pages option",
 		.group = 0,
 	},
 	{
@@ -805,19 +4503,67 @@ static struct argp_option options[] = {
 		.group = 0,
 	},
 	{
-		.name = "random_batch",
+		.name = "seed",
 		.key = 2,
 		.arg = "<int>",
 		.flags = 0,
-		.doc = "number of random number arrays",
+		.doc = "seed for the random numbers",
 		.group = 0,
 	},
 	{
-		.name = "random_array",
-		.key = 3,
-		.arg = "<int>",
+		.name = "sample_latency",
+		.key = 5,
+		.arg = "<interval>",
+		.flags = 0,
+		.doc = "record latency of one per <interval> accesses",
+		.group = 0,
+	},
+	{
+		.name = "stats_fd",
+		.key = 6,
+		.arg = "<fd>",
+		.flags = 0,
+		.doc = "write per-pattern statistics to the file descriptor",
+		.group = 0,
+	},
+	{
+		.name = "stats_format",
+		.key = 7,
+		.arg = "<json|csv>",
+		.flags = 0,
+		.doc = "format of the statistics (default json)",
+		.group = 0,
+	},
+	{
+		.name = "init_threads",
+		.key = 9,
+		.arg = "<nr>",
+		.flags = 0,
+		.doc = "number of threads for prefaulting and loading regions",
+		.group = 0,
+	},
+	{
+		.name = "record",
+		.key = 11,
+		.arg = "<file>",
+		.flags = 0,
+		.doc = "record sampled accesses to the trace file",
+		.group = 0,
+	},
+	{
+		.name = "record_interval",
+		.key = 12,
+		.arg = "<interval>",
+		.flags = 0,
+		.doc = "record one per <interval> accesses (default 1024)",
+		.group = 0,
+	},
+	{
+		.name = "perf",
+		.key = 8,
+		.arg = 0,
 		.flags = 0,
-		.doc = "size of each random number array",
+		.doc = "report hardware performance counters for each phase",
 		.group = 0,
 	},
 	{
@@ -835,16 +4581,31 @@ static struct argp_option options[] = {
 char *config_file = "configs/default";
 int do_print_config;
 int dryrun;
+/* compile the config file to compile_out instead of running it */
+int compile_mode;
+char *compile_out;
 
 error_t parse_option(int key, char *arg, struct argp_state *state)
 {
 	switch(key) {
 	case ARGP_KEY_ARG:
-		if (state->arg_num > 0)
+		if (state->arg_num == 0 && !strcmp(arg, "compile")) {
+			compile_mode = 1;
+			break;
+		}
+		if (compile_mode && state->arg_num == 2) {
+			compile_out = arg;
+			break;
+		}
+		if (state->arg_num > (compile_mode ? 1 : 0))
 			argp_usage(state);
 		config_file = (char *)malloc((strlen(arg) + 1 ) * sizeof(char));
 		strcpy(config_file, arg);
 		break;
+	case ARGP_KEY_END:
+		if (compile_mode && !compile_out)
+			argp_usage(state);
+		break;
 	case 'p':
 		do_print_config = 1;
 		break;
@@ -867,16 +4628,9 @@ error_t parse_option(int key, char *arg, struct argp_state *state)
 				arg);
 		return ARGP_ERR_UNKNOWN;
 	case 'r':
-		if (!strcmp("ro", arg)) {
-			default_rw_mode = READ_ONLY;
-			break;
-		} else if (!strcmp("wo", arg)) {
-			default_rw_mode = WRITE_ONLY;
-			break;
-		} else if (!strcmp("rw", arg)) {
-			default_rw_mode = READ_WRITE;
+		default_rw_mode = rwmode_of(arg);
+		if (default_rw_mode != NR_RW_MODES)
 			break;
-		}
 		fprintf(stderr, "wrong default_rwmode input %s\n", arg);
 		return ARGP_ERR_UNKNOWN;
 	case 'c':
@@ -889,14 +4643,48 @@ error_t parse_option(int key, char *arg, struct argp_state *state)
 		log_interval_ms = atoi(arg);
 		break;
 	case 2:
-		rand_batch = atoi(arg);
-		break;
-	case 3:
-		rand_arr_sz = atoi(arg);
+		rnd_seed = strtoull(arg, NULL, 0);
 		break;
 	case 4:
 		nr_accesses_per_region = atoi(arg);
 		break;
+	case 5:
+		lat_sample_interval = atoi(arg);
+		if (lat_sample_interval < 0)
+			errx(1, "wrong latency sample interval: %s", arg);
+		break;
+	case 6:
+		stats_file = fdopen(atoi(arg), "w");
+		if (!stats_file)
+			err(1, "cannot open stats fd %s", arg);
+		break;
+	case 7:
+		if (!strcmp(arg, "json"))
+			stats_format = STATS_JSON;
+		else if (!strcmp(arg, "csv"))
+			stats_format = STATS_CSV;
+		else
+			errx(1, "wrong stats format: %s", arg);
+		break;
+	case 8:
+		perf_enabled = 1;
+		break;
+	case 9:
+		nr_init_threads = atoi(arg);
+		if (nr_init_threads < 1)
+			errx(1, "wrong number of init threads: %s", arg);
+		break;
+	case 10:
+		keep_regions = 1;
+		break;
+	case 11:
+		record_path = arg;
+		break;
+	case 12:
+		record_interval = atoi(arg);
+		if (record_interval < 1)
+			errx(1, "wrong record interval: %s", arg);
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
@@ -910,30 +4698,46 @@ int main(int argc, char *argv[])
 	struct argp argp = {
 		.options = options,
 		.parser = parse_option,
-		.args_doc = "[config file]",
+		.args_doc = "[config file]\n"
+			"compile <config file> <compiled config file>",
 		.doc = "Simulate given memory access pattern\v"
 			"\'config file\' argument is optional."
-			"  It defaults to \'configs/default\'",
+			"  It defaults to \'configs/default\'.  The config"
+			" file can be a compiled one.  \'compile\' writes the"
+			" config file in the compiled format.",
 	};
 	int i;
 
 	argp_parse(&argp, argc, argv, ARGP_IN_ORDER, NULL, NULL);
 	setlocale(LC_NUMERIC, "");
+	init_width_kernels();
+	if (stats_file && stats_format == STATS_CSV)
+		pr_stats_csv_header();
+	if (perf_enabled && !aperf_open(&perf)) {
+		warnx("no performance counter is available");
+		perf_enabled = 0;
+	}
 
-	for (i = 0; i < nr_repeats; i++) {
-		read_config(config_file, &config);
-		if (do_print_config && !quiet) {
-			pr_regions(config.regions, config.nr_regions);
-			pr_phases(config.phases, config.nr_phases);
-		}
-
-		if (dryrun)
-			return 0;
+	read_config(config_file, &config);
+	if (compile_mode) {
+		write_msb(&config, compile_out);
+		free_config(&config);
+		return 0;
+	}
+	if (do_print_config && !quiet) {
+		pr_regions(config.regions, config.nr_regions);
+		pr_phases(config.phases, config.nr_phases);
+	}
 
-		init_rndints();
-		exec_config(&config);
-		fini_rndints();
+	if (!dryrun) {
+		if (record_path)
+			open_recorder(&config);
+		for (i = 0; i < nr_repeats; i++)
+			exec_config(&config);
+		if (record_file)
+			close_recorder();
 	}
+	free_config(&config);
 
 	return 0;
 }
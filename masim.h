@@ -1,39 +1,311 @@
 #ifndef _MASIM_H
 #define _MASIM_H
 
+#include "misc.h"
+
+#define MAX_NUMA_NODES	1024
+
+/* page size and the transparent hugepage policy of the regions */
+enum page_policy {
+	PAGES_DEFAULT,	/* heap allocation */
+	PAGES_4K,	/* anonymous mapping, system default THP behavior */
+	PAGES_THP,	/* anonymous mapping with MADV_HUGEPAGE */
+	PAGES_NOTHP,	/* anonymous mapping with MADV_NOHUGEPAGE */
+	PAGES_HUGETLB,	/* hugetlb of the default hugepage size */
+	PAGES_2M,	/* 2 MiB hugetlb */
+	PAGES_1G,	/* 1 GiB hugetlb */
+	NR_PAGE_POLICIES,
+};
+
+/* what the memory of the regions is */
+enum region_backing {
+	BACKING_ANON,		/* anonymous memory */
+	BACKING_FILE,		/* shared mapping of a file */
+	BACKING_FILE_PRIVATE,	/* private mapping of a file */
+	BACKING_MEMFD,		/* memfd_create() */
+	BACKING_SHM,		/* POSIX shared memory */
+	BACKING_SYSV,		/* SysV shared memory */
+	NR_REGION_BACKINGS,
+};
+
+/* what to do for the pages of the regions before the phases start */
+enum region_populate {
+	POPULATE_NONE,
+	POPULATE_PREFAULT,	/* fault in all pages */
+	POPULATE_DROP,		/* reclaim the pages */
+	POPULATE_MAP,		/* MAP_POPULATE */
+};
+
+/* how to load the initial data file of the regions */
+enum region_load {
+	LOAD_READ,	/* read() into the region */
+	LOAD_COPY,	/* mmap() the file and copy it to the region */
+	LOAD_MAP,	/* mmap() the file as the region */
+};
+
 struct mregion {
 	char name[256];
 	size_t sz;
 	char *region;
 	char *data_file;
+	/* size of the units of pointer chasing chain.  Zero if not chased */
+	size_t chase_stride;
+	/* NUMA memory policy (MPOL_*), and the nodes for the policy */
+	int numa_mode;
+	unsigned long nodemask[MAX_NUMA_NODES / (sizeof(long) * 8)];
+	enum page_policy pages;
+	enum region_backing backing;
+	char *backing_file;	/* for BACKING_FILE{,_PRIVATE} */
+	enum region_populate populate;
+	enum region_load load;
+	/* the real mapping containing @region.  Zero @map_sz if not mapped */
+	void *map_addr;
+	size_t map_sz;
 };
 
 enum rw_mode {
 	READ_ONLY,
 	WRITE_ONLY,
 	READ_WRITE,
+	NT_WRITE_ONLY,		/* non-temporal stores */
+	FLUSH_WRITE_ONLY,	/* stores followed by cache line flushes */
+	NT_READ_ONLY,		/* non-temporal loads */
+	NR_RW_MODES,
+};
+
+enum access_order {
+	SEQUENTIAL,
+	RANDOM,
+	CHASE,		/* dependent loads following a random cyclic chain */
+	SHUFFLE,	/* each unit once per epoch, in a random permutation */
+	REPLAY,		/* accesses of a trace file */
+};
+
+/* distribution of the random accesses */
+enum access_dist {
+	UNIFORM,
+	ZIPF,		/* zipfian, hotter on lower addresses */
+	HOTSET,		/* some accesses to some bytes at the beginning */
+	GAUSSIAN,	/* normal distribution around a moving center */
+	NR_ACCESS_DISTS,
 };
 
+#define MAX_CHASE_CHAINS	32
+/* number of chains in chains sweep steps are 1, 2, 4, ..., MAX_CHASE_CHAINS */
+#define NR_CHASE_SWEEP_STEPS	6
+
+/*
+ * Access trace (mtr) file.  A header is followed by the records of the
+ * accesses, in the order of the time.  The number of the records is decided
+ * by the file size.  Values are in the byte order of the machine that wrote
+ * the file, like the compiled config.
+ */
+#define MTR_MAGIC	"MASIMMTR"
+#define MTR_VERSION	1
+#define MTR_TIMESTAMPS	(1 << 0)	/* ts_ns of the records are valid */
+
+struct mtr_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;	/* MSB_BYTE_ORDER */
+	uint32_t flags;
+	uint32_t pad;
+};
+
+struct mtr_record {
+	uint64_t ts_ns;		/* time of the access in nanoseconds */
+	uint64_t offset;	/* offset of the access in the region */
+	uint32_t region;	/* index of the region in the config */
+	uint32_t write;		/* 1 if the access is a write */
+};
+
+/* A mapped trace file that replayed by REPLAY patterns */
+struct mtrace {
+	struct mtr_record *records;
+	size_t nr_records;
+	int timestamps;
+	/* time of the first record and the time for a pass of the trace */
+	uint64_t start_ns;
+	uint64_t period_ns;
+	/* the regions that the records refer to */
+	struct mregion *regions;
+	int nr_regions;
+	void *map;
+	size_t map_sz;
+};
+
+struct access;
+
+/* Makes accesses of a pattern and returns the number of the accesses */
+typedef int (*access_fn)(struct access *access);
+
 struct access {
 	struct mregion *mregion;
-	int random_access;
+	enum access_order order;
 	size_t stride;
+	size_t width;	/* bytes to access at once */
+	/* offset in each stride-sized unit to access, for RANDOM and SHUFFLE */
+	size_t unit_offset;
 	int probability;
 	enum rw_mode rw_mode;
+	/* dedicated threads for this pattern.  Zero for the phase threads */
+	int nr_threads;
+	int *cpus;
+	int nr_cpus;
+	/* number of independent chains to follow together, for CHASE */
+	int nr_chains;
+	/* change nr_chains from one to MAX_CHASE_CHAINS during the phase */
+	int chains_sweep;
+	enum access_dist dist;
+	double dist_args[2];
+	struct avgn_zipf zipf;
+	/* accesses go to the first hot_units if a random number < threshold */
+	uint64_t hot_threshold;
+	size_t hot_units;
+	double gauss_sigma;	/* standard deviation in units */
+	double gauss_speed;	/* moving speed of the center in regions/sec */
+	access_fn fn;	/* kernel specialized for this pattern */
+	/* target accesses per msec of all threads.  Zero if not limited */
+	double rate;
+	double rate_bytes;	/* target bytes per sec, if given in bytes */
+	int nr_chunk_accesses;	/* accesses per call of fn */
+	char *trace_file;	/* for REPLAY */
+	struct mtrace *trace;
+	/* replay speed relative to the timestamps.  Zero if not paced */
+	double trace_speed;
 
 	/* For runtime only */
-	int prob_start;
+	int idx;	/* index in the phase */
 	size_t last_offset;
+	size_t chase_offsets[MAX_CHASE_CHAINS];
+	size_t gauss_center;
+	/* permutation of the units for current epoch, for SHUFFLE */
+	struct avgn_perm perm;
+	uint64_t perm_seed;
+	uint64_t shuffle_epoch;
+	/* this thread visits every shuffle_step-th units of the permutation */
+	size_t shuffle_first;
+	size_t shuffle_step;
+	size_t shuffle_pos;
+	/* this thread replays every trace_step-th records from trace_pos */
+	size_t trace_pos;
+	size_t trace_step;
+	size_t trace_prefetched;	/* records until here are prefetched */
+	/* trace time of the current pass, and that to replay until */
+	uint64_t trace_base;
+	uint64_t trace_until;
+	unsigned long long nr_accesses;
+	unsigned long long busy_cycles;
+	double cycles_per_access;	/* pacing interval of the thread */
+	unsigned long long idle_cycles;
+	struct ahist *lat_hist;	/* sampled latencies.  NULL if not sampled */
+	unsigned long long nr_unsampled;	/* accesses after last sample */
+	unsigned long long nr_unrecorded;	/* accesses after last record */
+	unsigned long long nr_recorded;
+	unsigned long long record_cycles;	/* time spent for recording */
+	int nr_workers;
+	unsigned long long sweep_accesses[NR_CHASE_SWEEP_STEPS];
+	unsigned long long sweep_cycles[NR_CHASE_SWEEP_STEPS];
 };
 
 struct phase {
 	char *name;
+	/* the phase ends after this.  Zero means no limit for work phases */
 	unsigned time_ms;
+	/* the phase ends after this many accesses or bytes, if non-zero */
+	unsigned long long work;
+	int work_in_bytes;
 	struct access *patterns;
 	int nr_patterns;
+	/* threads running the patterns that have no dedicated threads */
+	int nr_threads;
+	int *cpus;
+	int nr_cpus;
 
 	/* For runtime only */
 	int total_probability;
+	/* for selection of the patterns having no dedicated threads */
+	struct avgn_alias alias;
+};
+
+/*
+ * Compiled config (msb) file.  A header is followed by the arrays of the
+ * regions, the phases, the patterns, the cpu and node ids, and a table of
+ * NUL-terminated strings.  The arrays start at the offsets in the header,
+ * which are aligned to 8 bytes.  Strings are referred by their offsets in the
+ * string table, and regions by their indices.  Values are in the byte order
+ * of the machine that wrote the file, and the enums have the values of
+ * masim.h.  MSB_VERSION should be increased for any change of the layout or
+ * the enums.
+ */
+#define MSB_MAGIC	"MASIMMSB"
+#define MSB_VERSION	3
+#define MSB_BYTE_ORDER	0x01020304
+#define MSB_NONE	0xffffffff	/* no string */
+
+struct msb_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;	/* MSB_BYTE_ORDER */
+	uint64_t file_sz;
+	uint32_t nr_regions;
+	uint32_t nr_phases;
+	uint32_t nr_patterns;
+	uint32_t nr_ids;
+	uint64_t regions_off;
+	uint64_t phases_off;
+	uint64_t patterns_off;
+	uint64_t ids_off;
+	uint64_t strs_off;
+	uint64_t strs_sz;
+};
+
+struct msb_region {
+	uint64_t sz;
+	uint32_t name;
+	uint32_t data_file;
+	uint32_t backing_file;
+	int32_t numa_mode;
+	uint32_t nodes;		/* index of the first node id */
+	uint32_t nr_nodes;
+	uint8_t pages;
+	uint8_t backing;
+	uint8_t populate;
+	uint8_t load;
+	uint32_t pad;
+};
+
+struct msb_phase {
+	uint32_t name;
+	uint32_t time_ms;
+	uint32_t nr_threads;
+	uint32_t cpus;		/* index of the first cpu id */
+	uint32_t nr_cpus;
+	uint32_t patterns;	/* index of the first pattern */
+	uint32_t nr_patterns;
+	uint32_t work_in_bytes;
+	uint64_t work;
+};
+
+struct msb_pattern {
+	uint32_t region;
+	uint8_t order;
+	uint8_t rw_mode;
+	uint8_t dist;
+	uint8_t chains_sweep;
+	uint64_t stride;
+	uint64_t width;
+	uint64_t unit_offset;
+	double dist_args[2];
+	double rate;
+	double rate_bytes;
+	int32_t probability;
+	uint32_t nr_threads;
+	uint32_t cpus;		/* index of the first cpu id */
+	uint32_t nr_cpus;
+	uint32_t nr_chains;
+	uint32_t trace_file;
+	double trace_speed;
 };
 
 #endif /* _MASIM_H */
@@ -1,5 +1,7 @@
 # SPDX-License-Identifier: GPL-2.0
 
+import struct
+
 class Region:
     name = None
     sz_bytes = None
@@ -57,3 +59,86 @@ def fmt_config(regions, phases):
 
 def pr_config(regions, phases):
     print(fmt_config(regions, phases))
+
+# Compiled config (msb) format.  Should be same to that of masim.h
+msb_magic = b'MASIMMSB'
+msb_version = 3
+msb_byte_order = 0x01020304
+msb_none = 0xffffffff
+msb_header_fmt = '=8sIIQIIIIQQQQQQ'
+msb_region_fmt = '=QIIIiIIBBBBI'
+msb_phase_fmt = '=IIIIIIIIQ'
+msb_pattern_fmt = '=IBBBBQQQddddiIIIIId'
+msb_rw_modes = ['ro', 'wo', 'rw', 'nt_wo', 'flush_wo', 'nt_ro']
+
+def msb_align(buf):
+    buf += b'\0' * ((8 - len(buf) % 8) % 8)
+    return len(buf)
+
+def fmt_msb(regions, phases):
+    '''Returns the config in the compiled format, as masim compile does'''
+    strs = bytearray()
+    def msb_str(string):
+        if string is None:
+            return msb_none
+        off = len(strs)
+        strs.extend(string.encode() + b'\0')
+        return off
+
+    region_indices = {}
+    regions_buf = bytearray()
+    for idx, region in enumerate(regions):
+        region_indices[region.name] = idx
+        regions_buf += struct.pack(
+                msb_region_fmt, int(region.sz_bytes), msb_str(region.name),
+                msb_str(region.init_data_file), msb_none, 0, 0, 0,
+                0, 0, 0, 0, 0)
+
+    phases_buf = bytearray()
+    patterns_buf = bytearray()
+    nr_patterns = 0
+    for phase in phases:
+        phases_buf += struct.pack(
+                msb_phase_fmt, msb_str(phase.name), int(phase.runtime_ms),
+                1, 0, 0, nr_patterns, len(phase.patterns), 0, 0)
+        for pattern in phase.patterns:
+            # random patterns of zero stride access each byte, like masim
+            stride = pattern.stride
+            if pattern.randomness and stride == 0:
+                stride = 1
+            patterns_buf += struct.pack(
+                    msb_pattern_fmt, region_indices[pattern.region_name],
+                    1 if pattern.randomness else 0,
+                    msb_rw_modes.index(pattern.rw_mode), 0, 0,
+                    stride, 1, 0, 0, 0, 0, 0,
+                    pattern.access_probability, 0, 0, 0, 1, msb_none, 0)
+        nr_patterns += len(phase.patterns)
+
+    header_sz = struct.calcsize(msb_header_fmt)
+    buf = bytearray(header_sz)
+    offsets = []
+    for section in [regions_buf, phases_buf, patterns_buf, b'', strs]:
+        offsets.append(msb_align(buf))
+        buf += section
+    buf[:header_sz] = struct.pack(
+            msb_header_fmt, msb_magic, msb_version, msb_byte_order,
+            len(buf), len(regions), len(phases), nr_patterns, 0,
+            *offsets, len(strs))
+    return bytes(buf)
+
+# Access trace (mtr) format.  Should be same to that of masim.h
+mtr_magic = b'MASIMMTR'
+mtr_version = 1
+mtr_timestamps = 1
+mtr_header_fmt = '=8sIIII'
+mtr_record_fmt = '=QQII'
+
+def fmt_mtr(records, timestamps=True):
+    '''Returns the access trace file for the replay patterns.  records is a
+    list of (time in nanoseconds, region index, offset, is write) tuples'''
+    buf = bytearray(struct.pack(mtr_header_fmt, mtr_magic, mtr_version,
+        msb_byte_order, mtr_timestamps if timestamps else 0, 0))
+    for ts_ns, region, offset, write in records:
+        buf += struct.pack(mtr_record_fmt, ts_ns if timestamps else 0,
+                offset, region, 1 if write else 0)
+    return bytes(buf)
@@ -4,10 +4,15 @@
  * This file is a collection of miscellaneous functions that might be reused.
  */
 
+#define _GNU_SOURCE
+
+#include <linux/perf_event.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 
 #include "misc.h"
 
@@ -395,8 +400,8 @@ static char *acop_opts_to_optarg(struct acop_option **opts, int nr_ops)
 	char *optarg;
 	int optarg_len;
 
-	/* optarg may have one or two `:`s */
-	optarg = (char *)malloc(sizeof(char) * (nr_ops * 3));
+	/* optarg may have one or two `:`s, and the terminating NULL */
+	optarg = (char *)malloc(sizeof(char) * (nr_ops * 3 + 1));
 	optarg_len = 0;
 	for (i = 0; i < nr_ops; i++) {
 		opt = opts[i];
@@ -532,6 +537,83 @@ int acop_parse_opts(int argc, char *argv[])
 }
 
 
+/* athr: a thread utilities */
+#include <sched.h>
+
+/**
+ * athr_start - Start a thread running @func with &@thr->arg
+ *
+ * @thr		The thread.  @thr->cpu should be set before the call.
+ * @func	The thread function.
+ *
+ * If @thr->cpu is not negative, the thread is pinned on the cpu before it
+ * starts running @func.
+ *
+ * Returns zero if success, an error number else.
+ */
+int athr_start(struct athr *thr, void *(*func)(void *))
+{
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int ret;
+
+	thr->arg.stop = 0;
+	ret = pthread_attr_init(&attr);
+	if (ret)
+		return ret;
+	if (thr->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(thr->cpu, &cpus);
+		ret = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		if (ret)
+			goto out;
+	}
+	ret = pthread_create(&thr->thread, &attr, func, &thr->arg);
+out:
+	pthread_attr_destroy(&attr);
+	return ret;
+}
+
+void athr_stop(struct athr *thr)
+{
+	ACCESS_ONCE(thr->arg.stop) = 1;
+}
+
+int athr_join(struct athr *thr)
+{
+	return pthread_join(thr->thread, NULL);
+}
+
+
+/* arnd: a random number generator */
+
+static uint64_t arnd_splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+/**
+ * arnd_seed - Initialize a random number generator state
+ *
+ * @rnd		The state to initialize.
+ * @seed	The seed.  Any value including zero is ok.
+ *
+ * The state is filled with splitmix64 outputs of @seed, as recommended by the
+ * authors of xoshiro generators.
+ */
+void arnd_seed(struct arnd *rnd, uint64_t seed)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		rnd->s[i] = arnd_splitmix64(&seed);
+}
+
+
 /* a value generator */
 
 unsigned long long avgn_make_val(struct avgn_prob_dist *dist,
@@ -561,6 +643,513 @@ unsigned long long avgn_make_val(struct avgn_prob_dist *dist,
 	return 0;
 }
 
+/**
+ * avgn_alias_init - Build an alias table
+ *
+ * @alias	The table to build.
+ * @weights	Relative weights of the indices.
+ * @n		Number of the indices.  Should be positive.
+ *
+ * The table is built with Vose's algorithm.  Indices having zero weight are
+ * never selected.  Client should free the table with avgn_alias_free().
+ *
+ * Returns zero if success, non-zero if the sum of the weights is zero.
+ */
+int avgn_alias_init(struct avgn_alias *alias, const unsigned *weights,
+		uint32_t n)
+{
+	uint32_t *small, *large;
+	uint32_t nr_small = 0, nr_large = 0;
+	double *probs;
+	double total = 0;
+	uint32_t i, s, l;
+
+	for (i = 0; i < n; i++)
+		total += weights[i];
+	if (!total)
+		return 1;
+
+	alias->n = n;
+	alias->thresholds = malloc(sizeof(*alias->thresholds) * n);
+	alias->aliases = malloc(sizeof(*alias->aliases) * n);
+	probs = malloc(sizeof(*probs) * n);
+	small = malloc(sizeof(*small) * n);
+	large = malloc(sizeof(*large) * n);
+	if (!alias->thresholds || !alias->aliases || !probs || !small ||
+			!large) {
+		fprintf(stderr, "[%s] alloc failed\n", __func__);
+		exit(1);
+	}
+
+	/* scale the probabilities to have average one */
+	for (i = 0; i < n; i++) {
+		probs[i] = weights[i] * n / total;
+		if (probs[i] < 1)
+			small[nr_small++] = i;
+		else
+			large[nr_large++] = i;
+	}
+	while (nr_small && nr_large) {
+		s = small[--nr_small];
+		l = large[--nr_large];
+		alias->thresholds[s] = probs[s] * 0x1.0p32;
+		alias->aliases[s] = l;
+		probs[l] -= 1 - probs[s];
+		if (probs[l] < 1)
+			small[nr_small++] = l;
+		else
+			large[nr_large++] = l;
+	}
+	/* remainings have probability one, with small rounding errors */
+	while (nr_large) {
+		l = large[--nr_large];
+		alias->thresholds[l] = UINT32_MAX;
+		alias->aliases[l] = l;
+	}
+	while (nr_small) {
+		s = small[--nr_small];
+		alias->thresholds[s] = UINT32_MAX;
+		alias->aliases[s] = s;
+	}
+
+	free(probs);
+	free(small);
+	free(large);
+	return 0;
+}
+
+void avgn_alias_free(struct avgn_alias *alias)
+{
+	free(alias->thresholds);
+	free(alias->aliases);
+}
+
+/**
+ * avgn_perm_init - Set up a pseudo-random permutation
+ *
+ * @perm	The permutation to set up.
+ * @n		Number of the values.  Should be positive.
+ * @seed	Seed of the permutation.  Same seed makes same permutation.
+ */
+void avgn_perm_init(struct avgn_perm *perm, uint64_t n, uint64_t seed)
+{
+	struct arnd rnd;
+	unsigned bits;
+	int i;
+
+	perm->n = n;
+	bits = n > 1 ? 64 - __builtin_clzll(n - 1) : 0;
+	perm->half_bits = (bits + 1) / 2;
+	perm->half_mask = (1ULL << perm->half_bits) - 1;
+	arnd_seed(&rnd, seed);
+	for (i = 0; i < AVGN_PERM_ROUNDS; i++)
+		perm->keys[i] = arnd_next(&rnd);
+}
+
+/*
+ * Zipf distribution sampler using the rejection-inversion method[1].  It
+ * needs no precomputation proportional to n, and each sampling needs a
+ * constant number of random numbers in average.
+ *
+ * [1] W. Hormann and G. Derflinger, "Rejection-inversion to generate variates
+ *     from monotone discrete distributions", ACM TOMACS, 1996.
+ */
+
+/* log(1 + x) / x, that precise for small x */
+static double avgn_zipf_helper1(double x)
+{
+	if (fabs(x) > 1e-8)
+		return log1p(x) / x;
+	return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+/* (exp(x) - 1) / x, that precise for small x */
+static double avgn_zipf_helper2(double x)
+{
+	if (fabs(x) > 1e-8)
+		return expm1(x) / x;
+	return 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+static double avgn_zipf_h(struct avgn_zipf *zipf, double x)
+{
+	return exp(-zipf->theta * log(x));
+}
+
+static double avgn_zipf_h_integral(struct avgn_zipf *zipf, double x)
+{
+	double log_x = log(x);
+
+	return avgn_zipf_helper2((1 - zipf->theta) * log_x) * log_x;
+}
+
+static double avgn_zipf_h_integral_inverse(struct avgn_zipf *zipf, double x)
+{
+	double t = x * (1 - zipf->theta);
+
+	if (t < -1)
+		t = -1;
+	return exp(avgn_zipf_helper1(t) * x);
+}
+
+/**
+ * avgn_zipf_init - Initialize a zipf distribution sampler
+ *
+ * @zipf	The sampler to initialize.
+ * @n		Number of the elements.  Should be positive.
+ * @theta	The exponent.  Should not be negative.
+ */
+void avgn_zipf_init(struct avgn_zipf *zipf, uint64_t n, double theta)
+{
+	zipf->n = n;
+	zipf->theta = theta;
+	zipf->h_integral_x1 = avgn_zipf_h_integral(zipf, 1.5) - 1;
+	zipf->h_integral_n = avgn_zipf_h_integral(zipf, n + 0.5);
+	zipf->s = 2 - avgn_zipf_h_integral_inverse(zipf,
+			avgn_zipf_h_integral(zipf, 2.5) -
+			avgn_zipf_h(zipf, 2));
+}
+
+/**
+ * avgn_zipf_val - Returns a random value of a zipf distribution
+ *
+ * @zipf	The sampler.
+ * @rnd		Random number generator to use.
+ *
+ * Returns a value in [1, @zipf->n].  Smaller values are more frequent.
+ */
+uint64_t avgn_zipf_val(struct avgn_zipf *zipf, struct arnd *rnd)
+{
+	double u, x;
+	uint64_t k;
+
+	while (1) {
+		u = zipf->h_integral_n + avgn_uniform(rnd) *
+			(zipf->h_integral_x1 - zipf->h_integral_n);
+		x = avgn_zipf_h_integral_inverse(zipf, u);
+		if (x < 1)
+			k = 1;
+		else if (x + 0.5 >= zipf->n)
+			k = zipf->n;
+		else
+			k = x + 0.5;
+		if (k - x <= zipf->s || u >= avgn_zipf_h_integral(zipf,
+					k + 0.5) - avgn_zipf_h(zipf, k))
+			return k;
+	}
+}
+
+/* ahist */
+
+void ahist_merge(struct ahist *dst, struct ahist *src)
+{
+	int i;
+
+	for (i = 0; i < AHIST_NR_BUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+	dst->nr_values += src->nr_values;
+}
+
+/* Returns the largest value that can be recorded in @bucket */
+static uint64_t ahist_bucket_max(int bucket)
+{
+	int shift;
+	uint64_t sub;
+
+	if (bucket < (1 << AHIST_SUB_BITS))
+		return bucket;
+	shift = (bucket >> AHIST_SUB_BITS) - 1;
+	sub = bucket & ((1 << AHIST_SUB_BITS) - 1);
+	return (((1ULL << AHIST_SUB_BITS) + sub) << shift) +
+		((1ULL << shift) - 1);
+}
+
+/**
+ * ahist_percentile - Get a percentile of the recorded values
+ *
+ * @hist	The histogram.
+ * @percentile	The percentile in [0, 100].
+ *
+ * Returns the largest value of the bucket having the percentile, or zero if
+ * no value is recorded.
+ */
+uint64_t ahist_percentile(struct ahist *hist, double percentile)
+{
+	uint64_t target, sum = 0;
+	int i;
+
+	if (!hist->nr_values)
+		return 0;
+	target = hist->nr_values * percentile / 100;
+	if (target < 1)
+		target = 1;
+	if (target > hist->nr_values)
+		target = hist->nr_values;
+	for (i = 0; i < AHIST_NR_BUCKETS; i++) {
+		sum += hist->counts[i];
+		if (sum >= target)
+			break;
+	}
+	return ahist_bucket_max(i);
+}
+
+/* aperf */
+
+const char * const aperf_event_names[] = {
+	[APERF_CYCLES] = "cycles",
+	[APERF_INSTRUCTIONS] = "instructions",
+	[APERF_LLC_MISSES] = "LLC misses",
+	[APERF_DTLB_MISSES] = "dTLB misses",
+	[APERF_STALLED_BACKEND] = "backend stall cycles",
+};
+
+#define APERF_HW_CACHE(cache, op, result)	\
+	((cache) | ((op) << 8) | ((result) << 16))
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} aperf_events[] = {
+	[APERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	[APERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_INSTRUCTIONS},
+	[APERF_LLC_MISSES] = {PERF_TYPE_HW_CACHE,
+		APERF_HW_CACHE(PERF_COUNT_HW_CACHE_LL,
+				PERF_COUNT_HW_CACHE_OP_READ,
+				PERF_COUNT_HW_CACHE_RESULT_MISS)},
+	[APERF_DTLB_MISSES] = {PERF_TYPE_HW_CACHE,
+		APERF_HW_CACHE(PERF_COUNT_HW_CACHE_DTLB,
+				PERF_COUNT_HW_CACHE_OP_READ,
+				PERF_COUNT_HW_CACHE_RESULT_MISS)},
+	[APERF_STALLED_BACKEND] = {PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+};
+
+/**
+ * aperf_open - Open the hardware performance counters
+ *
+ * @perf	The counters to open.
+ *
+ * The counters are inherited to the threads that created after this call,
+ * and reading the counters returns the sum of the threads.  Events that the
+ * system doesn't support or allow are not counted.
+ *
+ * Returns the number of the opened counters.
+ */
+int aperf_open(struct aperf *perf)
+{
+	struct perf_event_attr attr;
+	int i, nr_opened = 0;
+
+	for (i = 0; i < NR_APERF_EVENTS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = aperf_events[i].type;
+		attr.config = aperf_events[i].config;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			PERF_FORMAT_TOTAL_TIME_RUNNING;
+		perf->fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1,
+				0);
+		if (perf->fds[i] >= 0)
+			nr_opened++;
+	}
+	return nr_opened;
+}
+
+/**
+ * aperf_read - Read the counters
+ *
+ * @perf	The counters to read.
+ * @vals	Array of NR_APERF_EVENTS values to store the counts.
+ *
+ * The counts are scaled if the counters were multiplexed.  APERF_NA is
+ * stored for events that not counted.
+ */
+void aperf_read(struct aperf *perf, uint64_t *vals)
+{
+	/* value, time enabled, and time running */
+	uint64_t buf[3];
+	int i;
+
+	for (i = 0; i < NR_APERF_EVENTS; i++) {
+		vals[i] = APERF_NA;
+		if (perf->fds[i] < 0)
+			continue;
+		if (read(perf->fds[i], buf, sizeof(buf)) != sizeof(buf))
+			continue;
+		if (!buf[2]) {
+			vals[i] = buf[1] ? APERF_NA : 0;
+			continue;
+		}
+		vals[i] = buf[2] < buf[1] ?
+			(double)buf[0] * buf[1] / buf[2] : buf[0];
+	}
+}
+
+void aperf_close(struct aperf *perf)
+{
+	int i;
+
+	for (i = 0; i < NR_APERF_EVENTS; i++) {
+		if (perf->fds[i] >= 0)
+			close(perf->fds[i]);
+		perf->fds[i] = -1;
+	}
+}
+
+/* aarena */
+
+/**
+ * aarena_alloc - Allocate memory from an arena
+ *
+ * @arena	The arena.  Should be zero-initialized before the first use.
+ * @sz		Size of the memory to allocate.
+ *
+ * The memory is aligned to 16 bytes.
+ *
+ * Returns the allocated memory, or NULL if failed.
+ */
+void *aarena_alloc(struct aarena *arena, size_t sz)
+{
+	struct aarena_chunk *chunk = arena->chunks;
+	size_t chunk_sz;
+	void *ret;
+
+	sz = (sz + 15) & ~(size_t)15;
+	if (chunk && chunk->sz - chunk->used >= sz) {
+		ret = chunk->data + chunk->used;
+		chunk->used += sz;
+		return ret;
+	}
+
+	chunk_sz = sz > AARENA_CHUNK_SZ / 4 ? sz : AARENA_CHUNK_SZ;
+	chunk = malloc(sizeof(*chunk) + chunk_sz);
+	if (!chunk)
+		return NULL;
+	chunk->sz = chunk_sz;
+	chunk->used = sz;
+	/* keep the current chunk for the small allocations */
+	if (chunk_sz == sz && arena->chunks) {
+		chunk->next = arena->chunks->next;
+		arena->chunks->next = chunk;
+	} else {
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+	return chunk->data;
+}
+
+char *aarena_strdup(struct aarena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *ret;
+
+	ret = aarena_alloc(arena, len);
+	if (ret)
+		memcpy(ret, str, len);
+	return ret;
+}
+
+void aarena_free(struct aarena *arena)
+{
+	struct aarena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->chunks = NULL;
+}
+
+
+/* ahash */
+
+/* FNV-1a hash of @str */
+static uint64_t ahash_str(const char *str)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (; *str; str++)
+		h = (h ^ (unsigned char)*str) * 0x100000001b3ULL;
+	return h;
+}
+
+/**
+ * ahash_init - Initialize a hash table
+ *
+ * @hash	The table to initialize.
+ * @nr_entries	Maximum number of the entries.
+ *
+ * The table has at least twice of @nr_entries slots, so that the probes are
+ * short.  Client should free the table with ahash_free().
+ *
+ * Returns zero if success, non-zero if failed.
+ */
+int ahash_init(struct ahash *hash, size_t nr_entries)
+{
+	size_t nr_slots = 16;
+
+	while (nr_slots < nr_entries * 2)
+		nr_slots *= 2;
+	hash->keys = calloc(nr_slots, sizeof(*hash->keys));
+	hash->vals = malloc(sizeof(*hash->vals) * nr_slots);
+	if (!hash->keys || !hash->vals) {
+		ahash_free(hash);
+		return 1;
+	}
+	hash->mask = nr_slots - 1;
+	return 0;
+}
+
+/* Returns the slot for @key, which is empty if @key is not in @hash */
+static size_t ahash_slot(struct ahash *hash, const char *key)
+{
+	size_t i = ahash_str(key) & hash->mask;
+
+	while (hash->keys[i] && strcmp(hash->keys[i], key))
+		i = (i + 1) & hash->mask;
+	return i;
+}
+
+/**
+ * ahash_set - Add an entry to a hash table
+ *
+ * @hash	The table.
+ * @key		Key of the entry.
+ * @val		Value of the entry.  Should be non-negative.
+ *
+ * Returns zero if success, non-zero if @key is already in the table.
+ */
+int ahash_set(struct ahash *hash, const char *key, int val)
+{
+	size_t i = ahash_slot(hash, key);
+
+	if (hash->keys[i])
+		return 1;
+	hash->keys[i] = key;
+	hash->vals[i] = val;
+	return 0;
+}
+
+/* Returns the value for @key in @hash, or -1 if not found */
+int ahash_get(struct ahash *hash, const char *key)
+{
+	size_t i = ahash_slot(hash, key);
+
+	return hash->keys[i] ? hash->vals[i] : -1;
+}
+
+void ahash_free(struct ahash *hash)
+{
+	free(hash->keys);
+	free(hash->vals);
+	hash->keys = NULL;
+	hash->vals = NULL;
+}
+
 int yamemcmp(const void *s1, const void *s2, size_t n)
 {
 	size_t i;
@@ -1,7 +1,9 @@
 #ifndef _MISC_H
 #define _MISC_H
 
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -10,12 +12,14 @@
 
 #if defined(__x86_64__)
 
+#define cpu_relax()	__asm__ __volatile__("pause" ::: "memory")
 #define smp_rmb()	__asm__ __volatile__("lfence" ::: "memory")
 #define smp_wmb()	__asm__ __volatile__("sfence" ::: "memory")
 #define smp_mb()	__asm__ __volatile__("mfence" ::: "memory")
 
 #else
 
+#define cpu_relax()	barrier()
 #define smp_rmb()	__sync_synchronize()
 #define smp_wmb()	__sync_synchronize()
 #define smp_mb()	__sync_synchronize()
@@ -148,6 +152,79 @@ static inline unsigned long long aclk_freq(void)
 	return (aclk_clock() - start) * 10;
 }
 
+/*
+ * aclk_start / aclk_end - read the clock before and after a short event
+ *
+ * The reads are serialized with the instructions of the event, so that the
+ * out-of-order execution cannot move the event, e.g., a load, out of the
+ * measured window.  aclk_end() waits for the loads of the event to complete.
+ */
+#if defined(__i386__) || defined(__x86_64__)
+static inline unsigned long long aclk_start(void)
+{
+	unsigned hi, lo;
+	__asm__ __volatile__ ("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) : :
+			"memory");
+	return ( (unsigned long long)lo)|( ((unsigned long long)hi)<<32 );
+}
+
+static inline unsigned long long aclk_end(void)
+{
+	unsigned hi, lo;
+	__asm__ __volatile__ ("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi) : :
+			"ecx", "memory");
+	return ( (unsigned long long)lo)|( ((unsigned long long)hi)<<32 );
+}
+
+#elif defined(__aarch64__)
+static inline unsigned long long aclk_start(void)
+{
+	unsigned long long int val;
+	__asm__ __volatile__("dsb ish\n\tisb\n\tmrs %0, cntvct_el0\n\tisb"
+			: "=r"(val) : : "memory");
+	return val;
+}
+
+static inline unsigned long long aclk_end(void)
+{
+	return aclk_start();
+}
+
+#else
+static inline unsigned long long aclk_start(void)
+{
+	__sync_synchronize();
+	return aclk_clock();
+}
+
+static inline unsigned long long aclk_end(void)
+{
+	return aclk_start();
+}
+
+#endif
+
+/*
+ * aclk_overhead - return the overhead of aclk_start() and aclk_end() in clocks
+ *
+ * The overhead is the minimum difference of aclk_start() and aclk_end() that
+ * called consecutively, which should be subtracted from the measured time of
+ * short events.
+ */
+static inline unsigned long long aclk_overhead(void)
+{
+	unsigned long long start, diff, min = -1ULL;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		start = aclk_start();
+		diff = aclk_end() - start;
+		if (diff < min)
+			min = diff;
+	}
+	return min;
+}
+
 
 /* astr */
 
@@ -206,13 +283,89 @@ void acop_handle_help(struct acop_option *opt, char *arg);
 
 /* athr */
 
+/*
+ * Argument for athr thread functions.  The thread function receives a pointer
+ * to this struct and should return as soon as it finds @stop set.
+ */
 struct athr_arg {
 	unsigned stop;
 	void *thr_arg;
 };
 
-int athr_run_for(void *(*func)(void *), struct athr_arg *arg,
-			unsigned runtime);
+struct athr {
+	pthread_t thread;
+	int cpu;	/* cpu to pin the thread on, or -1 */
+	struct athr_arg arg;
+};
+
+int athr_start(struct athr *thr, void *(*func)(void *));
+void athr_stop(struct athr *thr);
+int athr_join(struct athr *thr);
+
+
+/* arnd: a random number generator */
+
+/*
+ * State of xoshiro256** generator[1].  The generator is not thread-safe, so
+ * each thread should have its own state.
+ *
+ * [1] https://prng.di.unimi.it/
+ */
+struct arnd {
+	uint64_t s[4];
+};
+
+void arnd_seed(struct arnd *rnd, uint64_t seed);
+
+static inline uint64_t arnd_rotl(const uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+/* Returns a random 64 bits integer */
+static inline uint64_t arnd_next(struct arnd *rnd)
+{
+	uint64_t *s = rnd->s;
+	const uint64_t result = arnd_rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = arnd_rotl(s[3], 45);
+
+	return result;
+}
+
+/* Returns the high 64 bits of the 128 bits product of @a and @b */
+static inline uint64_t arnd_mulhi(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	return ((unsigned __int128)a * b) >> 64;
+#else
+	uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+	uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+	uint64_t lo_lo = a_lo * b_lo;
+	uint64_t hi_lo = a_hi * b_lo;
+	uint64_t lo_hi = a_lo * b_hi;
+	uint64_t mid = (lo_lo >> 32) + (uint32_t)hi_lo + (uint32_t)lo_hi;
+
+	return a_hi * b_hi + (hi_lo >> 32) + (lo_hi >> 32) + (mid >> 32);
+#endif
+}
+
+/*
+ * Returns a random integer in [0, @range).  Maps the 64 bits random number to
+ * the range by multiply-shift[1] instead of the slow modulo.
+ *
+ * [1] https://lemire.me/blog/2016/06/27/a-fast-alternative-to-the-modulo-reduction/
+ */
+static inline uint64_t arnd_range(struct arnd *rnd, uint64_t range)
+{
+	return arnd_mulhi(arnd_next(rnd), range);
+}
 
 
 /* avgn: a value generator */
@@ -238,6 +391,236 @@ struct avgn_prob_dist {
 unsigned long long avgn_make_val(struct avgn_prob_dist *dist,
 				unsigned precision);
 
+/* Returns a random double in [0, 1) */
+static inline double avgn_uniform(struct arnd *rnd)
+{
+	return (arnd_next(rnd) >> 11) * 0x1.0p-53;
+}
+
+/*
+ * Returns a random double of approximated standard normal distribution.
+ *
+ * Sum of four 16 bits uniform random numbers (Irwin-Hall distribution) is
+ * used, so that only one random number generation is needed.  Values are
+ * bounded in about [-3.46, 3.46].
+ */
+static inline double avgn_normal(struct arnd *rnd)
+{
+	uint64_t r = arnd_next(rnd);
+	double sum;
+
+	sum = (double)(r & 0xffff) + ((r >> 16) & 0xffff) +
+		((r >> 32) & 0xffff) + (r >> 48);
+	/* mean 2 * 0xffff, and standard deviation 0xffff * sqrt(1/3) */
+	return (sum - 2 * 0xffff) / (0xffff * 0.5773502691896258);
+}
+
+/*
+ * Walker's alias table[1] for constant time selection of an index in [0, n)
+ * with given weights.  Index i is selected if a random 32 bits integer is
+ * smaller than thresholds[i] after i is uniformly selected.  aliases[i] is
+ * selected, otherwise.
+ *
+ * [1] https://www.keithschwarz.com/darts-dice-coins/
+ */
+struct avgn_alias {
+	uint32_t *thresholds;
+	uint32_t *aliases;
+	uint32_t n;
+};
+
+int avgn_alias_init(struct avgn_alias *alias, const unsigned *weights,
+		uint32_t n);
+void avgn_alias_free(struct avgn_alias *alias);
+
+static inline uint32_t avgn_alias_val(struct avgn_alias *alias,
+		struct arnd *rnd)
+{
+	uint64_t r = arnd_next(rnd);
+	uint32_t i = ((r >> 32) * alias->n) >> 32;
+
+	return (uint32_t)r < alias->thresholds[i] ? i : alias->aliases[i];
+}
+
+/*
+ * Pseudo-random permutation of [0, n) that generated lazily, without memory
+ * proportional to n.  A balanced Feistel network on [0, 4^half_bits) is a
+ * bijection, and values out of [0, n) are walked through the network again
+ * until they reach the range (cycle walking[1]), so the result is a
+ * permutation of [0, n).  As 4^half_bits < 4 * n, the walk is short.
+ *
+ * [1] J. Black and P. Rogaway, "Ciphers with arbitrary finite domains",
+ *     CT-RSA, 2002.
+ */
+#define AVGN_PERM_ROUNDS	4
+
+struct avgn_perm {
+	uint64_t n;
+	unsigned half_bits;
+	uint64_t half_mask;
+	uint64_t keys[AVGN_PERM_ROUNDS];
+};
+
+void avgn_perm_init(struct avgn_perm *perm, uint64_t n, uint64_t seed);
+
+static inline uint64_t avgn_perm_round(uint64_t x, uint64_t key)
+{
+	x = (x ^ key) * 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 31;
+	x *= 0x94d049bb133111ebULL;
+	return x ^ (x >> 29);
+}
+
+static inline uint64_t avgn_perm_feistel(struct avgn_perm *perm, uint64_t x)
+{
+	uint64_t l = x >> perm->half_bits;
+	uint64_t r = x & perm->half_mask;
+	uint64_t t;
+	int i;
+
+	for (i = 0; i < AVGN_PERM_ROUNDS; i++) {
+		t = l ^ (avgn_perm_round(r, perm->keys[i]) & perm->half_mask);
+		l = r;
+		r = t;
+	}
+	return (l << perm->half_bits) | r;
+}
+
+/* Returns @i-th value of the permutation.  @i should be in [0, n) */
+static inline uint64_t avgn_perm_val(struct avgn_perm *perm, uint64_t i)
+{
+	do {
+		i = avgn_perm_feistel(perm, i);
+	} while (i >= perm->n);
+	return i;
+}
+
+/* Zipf distribution on [1, n] with exponent theta */
+struct avgn_zipf {
+	uint64_t n;
+	double theta;
+	double h_integral_x1;
+	double h_integral_n;
+	double s;
+};
+
+void avgn_zipf_init(struct avgn_zipf *zipf, uint64_t n, double theta);
+uint64_t avgn_zipf_val(struct avgn_zipf *zipf, struct arnd *rnd);
+
+
+/* ahist: a histogram */
+
+/*
+ * Log-linear histogram of 64 bits values, similar to HdrHistogram[1].  Each
+ * power of two range of values is divided into 2^AHIST_SUB_BITS buckets of
+ * same size, so the relative error of the recorded values is bounded to
+ * 1 / 2^AHIST_SUB_BITS, with fixed small memory.
+ *
+ * [1] http://hdrhistogram.org/
+ */
+#define AHIST_SUB_BITS	4
+#define AHIST_NR_BUCKETS	((64 - AHIST_SUB_BITS + 1) << AHIST_SUB_BITS)
+
+struct ahist {
+	uint64_t counts[AHIST_NR_BUCKETS];
+	uint64_t nr_values;
+};
+
+static inline int ahist_bucket(uint64_t val)
+{
+	int shift;
+
+	if (val < (1 << AHIST_SUB_BITS))
+		return val;
+	shift = 63 - __builtin_clzll(val) - AHIST_SUB_BITS;
+	return ((shift + 1) << AHIST_SUB_BITS) +
+		(val >> shift) - (1 << AHIST_SUB_BITS);
+}
+
+static inline void ahist_add(struct ahist *hist, uint64_t val)
+{
+	hist->counts[ahist_bucket(val)]++;
+	hist->nr_values++;
+}
+
+void ahist_merge(struct ahist *dst, struct ahist *src);
+uint64_t ahist_percentile(struct ahist *hist, double percentile);
+
+
+/* aperf: hardware performance counters */
+
+enum aperf_event {
+	APERF_CYCLES,
+	APERF_INSTRUCTIONS,
+	APERF_LLC_MISSES,
+	APERF_DTLB_MISSES,
+	APERF_STALLED_BACKEND,	/* cycles stalled for the memory */
+	NR_APERF_EVENTS,
+};
+
+/* value of the events that not available */
+#define APERF_NA	(~0ULL)
+
+/*
+ * Counters of the calling process, including the threads that created after
+ * aperf_open().  Only user space events are counted.
+ */
+struct aperf {
+	int fds[NR_APERF_EVENTS];
+};
+
+extern const char * const aperf_event_names[];
+
+int aperf_open(struct aperf *perf);
+void aperf_read(struct aperf *perf, uint64_t *vals);
+void aperf_close(struct aperf *perf);
+
+
+
+/* aarena: an arena allocator */
+
+/*
+ * Allocations from an arena are freed at once by aarena_free().  Memory is
+ * taken from chunks of AARENA_CHUNK_SZ bytes, while large allocations have
+ * their own chunks.
+ */
+#define AARENA_CHUNK_SZ	(64 * 1024)
+
+struct aarena_chunk {
+	struct aarena_chunk *next;
+	size_t sz;
+	size_t used;
+	char data[] __attribute__((aligned(16)));
+};
+
+struct aarena {
+	struct aarena_chunk *chunks;
+};
+
+void *aarena_alloc(struct aarena *arena, size_t sz);
+char *aarena_strdup(struct aarena *arena, const char *str);
+void aarena_free(struct aarena *arena);
+
+
+/* ahash: a hash table of strings */
+
+/*
+ * Open addressing hash table that maps strings to non-negative integers.  The
+ * keys are not copied, so those should live while the table is used.  The
+ * table doesn't grow, so the maximum number of the entries should be given
+ * to ahash_init().
+ */
+struct ahash {
+	const char **keys;
+	int *vals;
+	size_t mask;
+};
+
+int ahash_init(struct ahash *hash, size_t nr_entries);
+int ahash_set(struct ahash *hash, const char *key, int val);
+int ahash_get(struct ahash *hash, const char *key);
+void ahash_free(struct ahash *hash);
+
 int yamemcmp(const void *s1, const void *s2, size_t n);
 
 void *yamemcpy(void *dest, const void *src, size_t n);
@@ -0,0 +1,38 @@
+# SPDX-License-Identifier: GPL-2.0
+
+'''Tests of masim_config.py.  Run after building masim, like below.
+
+    $ python3 test_masim_config.py
+'''
+
+import os
+import subprocess
+import tempfile
+import unittest
+
+from masim_config import *
+
+class TestFmtMsb(unittest.TestCase):
+    def test_same_to_masim_compile(self):
+        '''fmt_msb() output should be same to that of masim compile'''
+        regions = [Region('a', 64 * 1024 * 1024), Region('b', 4096)]
+        phases = [
+                Phase('random', 100, [
+                    AccessPattern('a', True, 0, 1, 'ro'),
+                    AccessPattern('b', True, 64, 3, 'wo')]),
+                Phase('seq', 200, [
+                    AccessPattern('a', False, 4096, 1, 'rw'),
+                    AccessPattern('b', False, 0, 1, 'nt_wo')]),
+                ]
+        with tempfile.TemporaryDirectory() as tmpdir:
+            cfg = os.path.join(tmpdir, 'cfg')
+            msb = os.path.join(tmpdir, 'msb')
+            with open(cfg, 'w') as f:
+                f.write(fmt_config(regions, phases))
+            subprocess.run(['./masim', 'compile', cfg, msb], check=True)
+            with open(msb, 'rb') as f:
+                self.assertEqual(fmt_msb(regions, phases), f.read())
+
+if __name__ == '__main__':
+    os.chdir(os.path.dirname(os.path.abspath(__file__)))
+    unittest.main()